@@ -0,0 +1,862 @@
+#include "glyphrasterizer.h"
+#include "glyphblending.h"
+#include "fontfile.h"
+#include "utils.h"
+
+#include <glib.h>
+#include FT_LCD_FILTER_H
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Headless batch renderer
+ *
+ * Renders ranges of glyphs with the same load and blending code as the viewer
+ * but without GTK, for regression testing on machines without a display. Each
+ * glyph is rendered black on white for every combination of the sizes,
+ * hinting modes and render modes asked for, and written out as PNG or
+ * PGM/PPM files or appended to a single binary blob.
+ *
+ * Glyphs are rendered on a pool of threads, each with its own FT_Library and
+ * face on the shared mapping, and written in order by the main thread so the
+ * output is the same however many threads are used. Glyphs that can't be
+ * rendered are reported and skipped, the exit status is 1 if there were any.
+ */
+
+/* Rendered glyphs allowed to wait for writing before the workers hold off */
+#define BATCH_WINDOW 256
+
+/* Identifies blob files and their layout version */
+#define BATCH_BLOB_MAGIC "GVBATCH1"
+
+
+  typedef enum
+  {
+    OUTPUT_PNG,
+    OUTPUT_PGM,
+    OUTPUT_BLOB
+  } OutputFormat;
+
+
+  /* A glyph to render, by index or by the character it was mapped from */
+  typedef struct BatchGlyphRec_
+  {
+    FT_UInt          glyph_index;
+
+    /* 0 when the glyph was given by index */
+    gunichar         codepoint;
+  } BatchGlyph;
+
+
+  /* One combination of the settings each glyph is rendered with */
+  typedef struct BatchModeRec_
+  {
+    /* In half points, the same as the viewer's text size */
+    unsigned int     text_size;
+    int              hinting_mode;
+    gboolean         lcd_rendering;
+  } BatchMode;
+
+
+  /* A finished job waiting to be written */
+  typedef struct BatchResultRec_
+  {
+    gboolean         done;
+
+    /* NULL if the glyph couldn't be rendered, with the Freetype error */
+    GlyphCacheEntry *entry;
+    FT_Error         error;
+  } BatchResult;
+
+
+  typedef struct BatchWorkerRec_
+  {
+    GThread         *thread;
+    FT_Library       library;
+    FT_Face          face;
+
+    /* Size the face was last set to */
+    unsigned int     text_size;
+  } BatchWorker;
+
+
+  static struct BatchOptions
+  {
+    gint             face_index;
+    gchar           *glyphs;
+    gchar           *chars;
+    gchar           *sizes;
+    gint             resolution;
+    gchar           *hinting;
+    gboolean         autohint;
+    gchar           *render;
+    gchar           *lcd_filter;
+    gdouble          gamma;
+    gchar           *format;
+    gchar           *output;
+    gint             threads;
+  } _options = {
+    .sizes      = "12",
+    .resolution = 96,
+    .hinting    = "normal",
+    .render     = "gray",
+    .lcd_filter = "default",
+    .format     = "png",
+    .output     = ".",
+  };
+
+
+  static GOptionEntry _option_entries[] =
+  {
+    { "face", 'f', 0, G_OPTION_ARG_INT, &_options.face_index,
+      "Face index in a collection (default 0)", "N" },
+    { "glyphs", 'g', 0, G_OPTION_ARG_STRING, &_options.glyphs,
+      "Glyph index range (default all glyphs)", "FIRST[-LAST]" },
+    { "chars", 'c', 0, G_OPTION_ARG_STRING, &_options.chars,
+      "Character range, unmapped characters are skipped", "U+XXXX[-U+XXXX]" },
+    { "sizes", 's', 0, G_OPTION_ARG_STRING, &_options.sizes,
+      "Sizes in points (default 12)", "PT,..." },
+    { "resolution", 'r', 0, G_OPTION_ARG_INT, &_options.resolution,
+      "Resolution in dpi (default 96)", "DPI" },
+    { "hinting", 'H', 0, G_OPTION_ARG_STRING, &_options.hinting,
+      "Hinting modes: none, light, normal (default normal)", "MODE,..." },
+    { "autohint", 'a', 0, G_OPTION_ARG_NONE, &_options.autohint,
+      "Force the autohinter", NULL },
+    { "render", 'm', 0, G_OPTION_ARG_STRING, &_options.render,
+      "Render modes: gray, lcd (default gray)", "MODE,..." },
+    { "lcd-filter", 'l', 0, G_OPTION_ARG_STRING, &_options.lcd_filter,
+      "LCD filter: none, light, default (default default)", "FILTER" },
+    { "gamma", 'G', 0, G_OPTION_ARG_DOUBLE, &_options.gamma,
+      "Blend linearly with this gamma (default no linear blending)", "GAMMA" },
+    { "format", 'F', 0, G_OPTION_ARG_STRING, &_options.format,
+      "Output format: png, pgm (PPM for LCD), blob (default png)", "FORMAT" },
+    { "output", 'o', 0, G_OPTION_ARG_STRING, &_options.output,
+      "Output directory, or file for blob output (default .)", "PATH" },
+    { "threads", 't', 0, G_OPTION_ARG_INT, &_options.threads,
+      "Rendering threads (default one per processor)", "N" },
+    { NULL }
+  };
+
+
+  static struct Batch
+  {
+    GMappedFile     *file;
+    FT_Face          face;
+
+    GArray          *glyphs;
+    GArray          *modes;
+    int              lcd_filter;
+    OutputFormat     format;
+
+    BatchWorker     *workers;
+    guint            num_workers;
+
+    /* Each job is a glyph in a mode, glyphs vary fastest */
+    guint            num_jobs;
+    gint             next_job;
+
+    /* Finished glyphs waiting to be written, by job number modulo the */
+    /* window                                                          */
+    GMutex           lock;
+    GCond            cond;
+    BatchResult      results[BATCH_WINDOW];
+    guint            written;
+
+    /* Jobs that couldn't be rendered */
+    guint            failed;
+
+    FILE            *blob;
+  } _batch;
+
+
+  /* -------------------------------------------------------------------------- *\
+   *
+   *                          == Option parsing ==
+   *
+  \* -------------------------------------------------------------------------- */
+
+  static void
+  _usage_error( const char *fmt, const char *value )
+  {
+    g_printerr( fmt, value );
+    g_printerr( "\n" );
+    exit( 1 );
+  }
+
+
+  /* Parse a number, hex if it's prefixed with "U+" or "0x". */
+  static gboolean
+  _parse_number( const char *s, gboolean hex, gulong *value )
+  {
+    char *end;
+
+    if( g_ascii_strncasecmp( s, "U+", 2 ) == 0 )
+    {
+      s += 2;
+      hex = TRUE;
+    }
+
+    errno = 0;
+    *value = strtoul( s, &end, hex ? 16 : 0 );
+
+    return errno == 0 && end != s && *end == '\0';
+  }
+
+
+  /* Parse "FIRST" or "FIRST-LAST" into an inclusive range. */
+  static void
+  _parse_range( const char  *range,
+                gboolean     hex,
+                gulong      *first,
+                gulong      *last )
+  {
+    gchar **parts = g_strsplit( range, "-", 2 );
+
+    if( !_parse_number( parts[0], hex, first ) ||
+        ( parts[1] && !_parse_number( parts[1], hex, last ) ) )
+      _usage_error( "Bad range: %s", range );
+
+    if( !parts[1] )
+      *last = *first;
+
+    if( *last < *first )
+      _usage_error( "Range is backwards: %s", range );
+
+    g_strfreev( parts );
+  }
+
+
+  static void
+  _add_glyph( FT_UInt glyph_index, gunichar codepoint )
+  {
+    BatchGlyph glyph = { glyph_index, codepoint };
+
+    g_array_append_val( _batch.glyphs, glyph );
+  }
+
+
+  static void
+  _parse_glyphs()
+  {
+    gulong first, last;
+
+    _batch.glyphs = g_array_new( FALSE, FALSE, sizeof( BatchGlyph ) );
+
+    if( _options.chars )
+    {
+      if( FT_Select_Charmap( _batch.face, FT_ENCODING_UNICODE ) )
+        _usage_error( "No unicode charmap found in %s", "the font" );
+
+      _parse_range( _options.chars, TRUE, &first, &last );
+
+      for( gulong c = first; c <= last; c++ )
+      {
+        FT_UInt glyph_index = FT_Get_Char_Index( _batch.face, c );
+
+        if( glyph_index )
+          _add_glyph( glyph_index, (gunichar) c );
+      }
+
+      return;
+    }
+
+    /* last would wrap around below */
+    if( _batch.face->num_glyphs <= 0 )
+      _usage_error( "No glyphs found in %s", "the font" );
+
+    first = 0;
+    last = _batch.face->num_glyphs - 1;
+
+    if( _options.glyphs )
+      _parse_range( _options.glyphs, FALSE, &first, &last );
+
+    if( last >= (gulong) _batch.face->num_glyphs )
+      _usage_error( "Glyph range goes past the end of the font: %s",
+                    _options.glyphs );
+
+    for( gulong g = first; g <= last; g++ )
+      _add_glyph( (FT_UInt) g, 0 );
+  }
+
+
+  static int
+  _parse_hinting_mode( const char *name )
+  {
+    if( strcmp( name, "none" ) == 0 )
+      return HINTING_MODE_NONE;
+    if( strcmp( name, "light" ) == 0 )
+      return HINTING_MODE_LIGHT;
+    if( strcmp( name, "normal" ) == 0 )
+      return HINTING_MODE_NORMAL;
+
+    _usage_error( "Unknown hinting mode: %s", name );
+    return 0;
+  }
+
+
+  static gboolean
+  _parse_render_mode( const char *name )
+  {
+    if( strcmp( name, "gray" ) == 0 || strcmp( name, "grey" ) == 0 )
+      return FALSE;
+    if( strcmp( name, "lcd" ) == 0 )
+      return TRUE;
+
+    _usage_error( "Unknown render mode: %s", name );
+    return FALSE;
+  }
+
+
+  /* Every combination of size, hinting mode and render mode. */
+  static void
+  _parse_modes()
+  {
+    gchar **sizes = g_strsplit( _options.sizes, ",", -1 );
+    gchar **hinting = g_strsplit( _options.hinting, ",", -1 );
+    gchar **render = g_strsplit( _options.render, ",", -1 );
+
+    _batch.modes = g_array_new( FALSE, FALSE, sizeof( BatchMode ) );
+
+    for( int r = 0; render[r]; r++ )
+    {
+      for( int h = 0; hinting[h]; h++ )
+      {
+        for( int s = 0; sizes[s]; s++ )
+        {
+          BatchMode mode;
+          char *end;
+          double points = g_ascii_strtod( sizes[s], &end );
+
+          if( end == sizes[s] || *end != '\0' || points <= 0 )
+            _usage_error( "Bad size: %s", sizes[s] );
+
+          mode.text_size = (unsigned int)( points * 2 + 0.5 );
+          mode.hinting_mode = _parse_hinting_mode( hinting[h] );
+          mode.lcd_rendering = _parse_render_mode( render[r] );
+
+          g_array_append_val( _batch.modes, mode );
+        }
+      }
+    }
+
+    g_strfreev( sizes );
+    g_strfreev( hinting );
+    g_strfreev( render );
+  }
+
+
+  static void
+  _parse_settings()
+  {
+    if( strcmp( _options.lcd_filter, "none" ) == 0 )
+      _batch.lcd_filter = FT_LCD_FILTER_NONE;
+    else if( strcmp( _options.lcd_filter, "light" ) == 0 )
+      _batch.lcd_filter = FT_LCD_FILTER_LIGHT;
+    else if( strcmp( _options.lcd_filter, "default" ) == 0 )
+      _batch.lcd_filter = FT_LCD_FILTER_DEFAULT;
+    else
+      _usage_error( "Unknown LCD filter: %s", _options.lcd_filter );
+
+    if( strcmp( _options.format, "png" ) == 0 )
+      _batch.format = OUTPUT_PNG;
+    else if( strcmp( _options.format, "pgm" ) == 0 )
+      _batch.format = OUTPUT_PGM;
+    else if( strcmp( _options.format, "blob" ) == 0 )
+      _batch.format = OUTPUT_BLOB;
+    else
+      _usage_error( "Unknown output format: %s", _options.format );
+
+    if( _options.resolution <= 0 )
+      _usage_error( "Bad resolution: %s", "must be positive" );
+  }
+
+
+  /* -------------------------------------------------------------------------- *\
+   *
+   *                             == Rendering ==
+   *
+  \* -------------------------------------------------------------------------- */
+
+  static void
+  _get_job( guint job, const BatchGlyph **glyph, const BatchMode **mode )
+  {
+    *glyph = &g_array_index( _batch.glyphs, BatchGlyph,
+                             job % _batch.glyphs->len );
+    *mode = &g_array_index( _batch.modes, BatchMode,
+                            job / _batch.glyphs->len );
+  }
+
+
+  /*
+   * Render a job, sets entry or returns the Freetype error if the glyph
+   * couldn't be rendered. A bad glyph (or size) shouldn't stop the rest.
+   */
+  static FT_Error
+  _render_job( BatchWorker *worker, guint job, GlyphCacheEntry **entry )
+  {
+    const BatchGlyph *glyph;
+    const BatchMode *mode;
+    GlyphCacheKey key;
+    FT_Error error;
+
+    _get_job( job, &glyph, &mode );
+
+    if( worker->text_size != mode->text_size )
+    {
+      error = FT_Set_Char_Size( worker->face,
+                                mode->text_size * 64 / 2,
+                                mode->text_size * 64 / 2,
+                                _options.resolution,
+                                _options.resolution );
+      if( error )
+        return error;
+
+      worker->text_size = mode->text_size;
+    }
+
+    memset( &key, 0, sizeof( key ) );
+
+    key.raster.face           = _batch.face;
+    key.raster.glyph_index    = glyph->glyph_index;
+    key.raster.text_size      = mode->text_size;
+    key.raster.resolution     = _options.resolution;
+    key.raster.hinting_mode   = mode->hinting_mode;
+    key.raster.force_autohint = _options.autohint;
+    key.raster.lcd_rendering  = mode->lcd_rendering;
+    key.raster.lcd_filter     = _batch.lcd_filter;
+
+    key.composite.linear_blending = _options.gamma > 0;
+    key.composite.gamma = _options.gamma > 0 ? _options.gamma : 0;
+    key.composite.gamma_linear_bits = _options.gamma > 0
+                                      ? GAMMA_LINEAR_BITS : 0;
+
+    for( int i = 0; i < 3; i++ )
+    {
+      key.composite.fg[i] = 0;
+      key.composite.bg[i] = 1;
+    }
+
+    return glyph_rasterize( worker->library, worker->face, &key, entry );
+  }
+
+
+  static gpointer
+  _worker_main( gpointer data )
+  {
+    BatchWorker *worker = data;
+
+    for( ;; )
+    {
+      guint job = (guint) g_atomic_int_add( &_batch.next_job, 1 );
+      GlyphCacheEntry *entry = NULL;
+      FT_Error error;
+
+      if( job >= _batch.num_jobs )
+        break;
+
+      /* Don't get too far ahead of the writer */
+      g_mutex_lock( &_batch.lock );
+
+      while( job >= _batch.written + BATCH_WINDOW )
+        g_cond_wait( &_batch.cond, &_batch.lock );
+
+      g_mutex_unlock( &_batch.lock );
+
+      error = _render_job( worker, job, &entry );
+
+      g_mutex_lock( &_batch.lock );
+      _batch.results[job % BATCH_WINDOW].done = TRUE;
+      _batch.results[job % BATCH_WINDOW].entry = entry;
+      _batch.results[job % BATCH_WINDOW].error = error;
+      g_cond_broadcast( &_batch.cond );
+      g_mutex_unlock( &_batch.lock );
+    }
+
+    return NULL;
+  }
+
+
+  static void
+  _start_workers()
+  {
+    _batch.num_workers = _options.threads > 0 ? (guint) _options.threads
+                                              : g_get_num_processors();
+    _batch.workers = g_new0( BatchWorker, _batch.num_workers );
+
+    for( guint i = 0; i < _batch.num_workers; i++ )
+    {
+      BatchWorker *worker = &_batch.workers[i];
+
+      if( FT_Init_FreeType( &worker->library ) )
+        panic( "Couldn't initalize Freetype for rasterizing" );
+
+      if( font_file_new_face( worker->library,
+                              _batch.file,
+                              _options.face_index,
+                              &worker->face ) )
+        panic( "Couldn't open the face for rasterizing" );
+
+      FT_Library_SetLcdFilter( worker->library, _batch.lcd_filter );
+
+      worker->thread = g_thread_new( "batch", _worker_main, worker );
+    }
+  }
+
+
+  static void
+  _stop_workers()
+  {
+    for( guint i = 0; i < _batch.num_workers; i++ )
+    {
+      BatchWorker *worker = &_batch.workers[i];
+
+      g_thread_join( worker->thread );
+      FT_Done_Face( worker->face );
+      FT_Done_FreeType( worker->library );
+    }
+
+    g_free( _batch.workers );
+  }
+
+
+  /* -------------------------------------------------------------------------- *\
+   *
+   *                              == Output ==
+   *
+  \* -------------------------------------------------------------------------- */
+
+  static const char *
+  _get_hinting_name( int hinting_mode )
+  {
+    switch( hinting_mode )
+    {
+      case HINTING_MODE_NONE:  return "none";
+      case HINTING_MODE_LIGHT: return "light";
+      default:                 return "normal";
+    }
+  }
+
+
+  /*
+   * Get a row of the glyph image as 8 bit values, one per pixel for greyscale
+   * renders or RGB for LCD ones. The glyph is black on white so any channel
+   * of a greyscale render will do.
+   */
+  static void
+  _get_row( cairo_surface_t *surface, int row, int channels, guchar *out )
+  {
+    int width = cairo_image_surface_get_width( surface );
+    const guint32 *pixels = (const guint32 *)(
+        cairo_image_surface_get_data( surface ) +
+        row * cairo_image_surface_get_stride( surface ) );
+
+    for( int x = 0; x < width; x++ )
+    {
+      guint32 pixel = pixels[x];
+
+      if( channels == 1 )
+        *out++ = ( pixel >> 8 ) & 0xFF;
+      else
+      {
+        *out++ = ( pixel >> 16 ) & 0xFF;
+        *out++ = ( pixel >> 8 ) & 0xFF;
+        *out++ = pixel & 0xFF;
+      }
+    }
+  }
+
+
+  static void
+  _write_pnm( const char       *path,
+              cairo_surface_t  *surface,
+              int               channels )
+  {
+    int width = cairo_image_surface_get_width( surface );
+    int height = cairo_image_surface_get_height( surface );
+    guchar *row = g_malloc( (gsize) width * channels + 1 );
+    FILE *f = fopen( path, "wb" );
+
+    if( !f )
+      panic( "Couldn't open %s for writing", path );
+
+    fprintf( f, "P%d\n%d %d\n255\n", channels == 1 ? 5 : 6, width, height );
+
+    for( int y = 0; y < height; y++ )
+    {
+      _get_row( surface, y, channels, row );
+      fwrite( row, channels, width, f );
+    }
+
+    if( fclose( f ) )
+      panic( "Couldn't write %s", path );
+
+    g_free( row );
+  }
+
+
+  static void
+  _write_u32( guint32 value )
+  {
+    guchar bytes[4] = { value & 0xFF, ( value >> 8 ) & 0xFF,
+                        ( value >> 16 ) & 0xFF, value >> 24 };
+
+    fwrite( bytes, 1, 4, _batch.blob );
+  }
+
+
+  /*
+   * Blob layout, all values little endian 32 bit: the magic and number of
+   * records, then for each record the glyph index, codepoint (0 if rendered
+   * by index), size in half points, hinting mode, 1 for LCD renders, width,
+   * height, bitmap left and top, followed by the pixel rows packed with one
+   * byte per pixel for greyscale or three (RGB) for LCD. Glyphs that couldn't
+   * be rendered have a record with no pixels, 0 for the size and position.
+   */
+  static void
+  _write_blob_record( const BatchGlyph  *glyph,
+                      const BatchMode   *mode,
+                      GlyphCacheEntry   *entry )
+  {
+    cairo_surface_t *surface = entry ? entry->surface : NULL;
+    int width = surface ? cairo_image_surface_get_width( surface ) : 0;
+    int height = surface ? cairo_image_surface_get_height( surface ) : 0;
+    int channels = mode->lcd_rendering ? 3 : 1;
+    guchar *row = g_malloc( (gsize) width * channels + 1 );
+
+    _write_u32( glyph->glyph_index );
+    _write_u32( glyph->codepoint );
+    _write_u32( mode->text_size );
+    _write_u32( mode->hinting_mode );
+    _write_u32( mode->lcd_rendering ? 1 : 0 );
+    _write_u32( width );
+    _write_u32( height );
+    _write_u32( entry ? (guint32) entry->bitmap_left : 0 );
+    _write_u32( entry ? (guint32) entry->bitmap_top : 0 );
+
+    for( int y = 0; y < height; y++ )
+    {
+      _get_row( surface, y, channels, row );
+      fwrite( row, channels, width, _batch.blob );
+    }
+
+    g_free( row );
+  }
+
+
+  static void
+  _report_failed_job( const BatchGlyph  *glyph,
+                      const BatchMode   *mode,
+                      FT_Error           error )
+  {
+    if( glyph->codepoint )
+      g_printerr( "Couldn't render U+%04X (glyph %u)", glyph->codepoint,
+                  glyph->glyph_index );
+    else
+      g_printerr( "Couldn't render glyph %u", glyph->glyph_index );
+
+    g_printerr( " at %gpt, %s hinting, %s: Freetype error 0x%02X\n",
+                mode->text_size / 2.0,
+                _get_hinting_name( mode->hinting_mode ),
+                mode->lcd_rendering ? "lcd" : "gray",
+                error );
+  }
+
+
+  /*
+   * Write out a finished job. Failed jobs are reported and get an empty blob
+   * record (so the records still line up with the jobs) or no file.
+   */
+  static void
+  _write_job( guint job, const BatchResult *result )
+  {
+    GlyphCacheEntry *entry = result->entry;
+    const BatchGlyph *glyph;
+    const BatchMode *mode;
+    gchar *name, *path;
+
+    _get_job( job, &glyph, &mode );
+
+    if( !entry )
+    {
+      _report_failed_job( glyph, mode, result->error );
+      _batch.failed++;
+    }
+    else
+      cairo_surface_flush( entry->surface );
+
+    if( _batch.format == OUTPUT_BLOB )
+    {
+      _write_blob_record( glyph, mode, entry );
+      return;
+    }
+
+    if( !entry )
+      return;
+
+    if( glyph->codepoint )
+      name = g_strdup_printf( "u%04X_%gpt_%s_%s.%s",
+                              glyph->codepoint,
+                              mode->text_size / 2.0,
+                              _get_hinting_name( mode->hinting_mode ),
+                              mode->lcd_rendering ? "lcd" : "gray",
+                              _batch.format == OUTPUT_PNG ? "png"
+                              : mode->lcd_rendering ? "ppm" : "pgm" );
+    else
+      name = g_strdup_printf( "g%05u_%gpt_%s_%s.%s",
+                              glyph->glyph_index,
+                              mode->text_size / 2.0,
+                              _get_hinting_name( mode->hinting_mode ),
+                              mode->lcd_rendering ? "lcd" : "gray",
+                              _batch.format == OUTPUT_PNG ? "png"
+                              : mode->lcd_rendering ? "ppm" : "pgm" );
+
+    path = g_build_filename( _options.output, name, NULL );
+
+    if( _batch.format == OUTPUT_PNG )
+    {
+      if( cairo_surface_write_to_png( entry->surface, path )
+          != CAIRO_STATUS_SUCCESS )
+        panic( "Couldn't write %s", path );
+    }
+    else
+      _write_pnm( path, entry->surface, mode->lcd_rendering ? 3 : 1 );
+
+    g_free( name );
+    g_free( path );
+  }
+
+
+  static void
+  _open_output()
+  {
+    if( _batch.format != OUTPUT_BLOB )
+    {
+      if( g_mkdir_with_parents( _options.output, 0755 ) )
+        _usage_error( "Couldn't create the output directory %s",
+                      _options.output );
+      return;
+    }
+
+    _batch.blob = fopen( _options.output, "wb" );
+
+    if( !_batch.blob )
+      _usage_error( "Couldn't open %s for writing", _options.output );
+
+    fwrite( BATCH_BLOB_MAGIC, 1, 8, _batch.blob );
+    _write_u32( _batch.num_jobs );
+  }
+
+
+  /* Write the glyphs out in job order as the workers finish them. */
+  static void
+  _write_results()
+  {
+    while( _batch.written < _batch.num_jobs )
+    {
+      guint job = _batch.written;
+      BatchResult result;
+
+      g_mutex_lock( &_batch.lock );
+
+      while( !_batch.results[job % BATCH_WINDOW].done )
+        g_cond_wait( &_batch.cond, &_batch.lock );
+
+      result = _batch.results[job % BATCH_WINDOW];
+      _batch.results[job % BATCH_WINDOW].done = FALSE;
+
+      g_mutex_unlock( &_batch.lock );
+
+      _write_job( job, &result );
+
+      if( result.entry )
+        glyph_cache_entry_unref( result.entry );
+
+      g_mutex_lock( &_batch.lock );
+      _batch.written++;
+      g_cond_broadcast( &_batch.cond );
+      g_mutex_unlock( &_batch.lock );
+    }
+
+    if( _batch.blob && fclose( _batch.blob ) )
+      panic( "Couldn't write %s", _options.output );
+  }
+
+
+  int
+  main( int argc, char *argv[] )
+  {
+    GOptionContext *context;
+    GError *error = NULL;
+    FT_Library library;
+    gint64 start;
+    double seconds;
+
+    context = g_option_context_new( "FONT - render glyphs without a display" );
+    g_option_context_add_main_entries( context, _option_entries, NULL );
+
+    if( !g_option_context_parse( context, &argc, &argv, &error ) )
+      _usage_error( "%s", error->message );
+
+    if( argc != 2 )
+    {
+      gchar *help = g_option_context_get_help( context, TRUE, NULL );
+
+      g_printerr( "%s", help );
+      g_free( help );
+      g_option_context_free( context );
+      return 1;
+    }
+
+    g_option_context_free( context );
+
+    _parse_settings();
+
+    _batch.file = font_file_open( argv[1], &error );
+
+    if( !_batch.file )
+      _usage_error( "%s", error->message );
+
+    /* Face used to map characters, each worker opens its own to render */
+    if( FT_Init_FreeType( &library ) )
+      panic( "Couldn't initalize Freetype" );
+
+    if( font_file_new_face( library, _batch.file, _options.face_index,
+                            &_batch.face ) )
+      _usage_error( "Couldn't open %s as a font", argv[1] );
+
+    _parse_glyphs();
+    _parse_modes();
+
+    _batch.num_jobs = _batch.glyphs->len * _batch.modes->len;
+
+    _open_output();
+
+    start = g_get_monotonic_time();
+
+    _start_workers();
+    _write_results();
+    _stop_workers();
+
+    seconds = ( g_get_monotonic_time() - start ) / 1e6;
+
+    g_print( "Rendered %u glyphs with %u thread%s in %.2f s (%.0f glyphs/s)\n",
+             _batch.num_jobs - _batch.failed, _batch.num_workers,
+             _batch.num_workers == 1 ? "" : "s", seconds,
+             seconds > 0 ? _batch.num_jobs / seconds : 0.0 );
+
+    if( _batch.failed )
+      g_printerr( "%u of %u glyphs couldn't be rendered\n",
+                  _batch.failed, _batch.num_jobs );
+
+    FT_Done_Face( _batch.face );
+    FT_Done_FreeType( library );
+    g_mapped_file_unref( _batch.file );
+
+    return _batch.failed ? 1 : 0;
+  }
+
+
+/* END */
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "glyphviewerglobals.h"
+#include "glyphrasterizer.h"
+#include "fontfile.h"
 #include "controls.h"
 #include "dialog_gotoindex.h"
 #include "dialog_gotochar.h"
@@ -9,6 +11,10 @@
 #include FT_LCD_FILTER_H
 
 
+/* How often the font open progress bar is updated in milliseconds */
+#define FONT_OPEN_PROGRESS_INTERVAL 100
+
+
   static struct MenuWidgets
   {
     GtkWidget *font_open_item;
@@ -24,21 +30,33 @@
     GtkWidget *gamma_correct;
     GtkWidget *gamma_inc;
     GtkWidget *gamma_dec;
+    GtkWidget *gamma_high_precision;
     GtkWidget *show_grid;
     GtkWidget *show_outline;
     GtkWidget *lcd_filter_submenu_entry;
     GtkWidget *lcd_filter_none;
     GtkWidget *lcd_filter_light;
     GtkWidget *lcd_filter_normal;
+    GtkWidget *prefetch_off;
+    GtkWidget *prefetch_1;
+    GtkWidget *prefetch_2;
+    GtkWidget *prefetch_4;
+    GtkWidget *cache_size_8;
+    GtkWidget *cache_size_32;
+    GtkWidget *cache_size_128;
+    GtkWidget *ft_cache_backend;
 
     GtkWidget *zoom_inc;
     GtkWidget *zoom_dec;
     GtkWidget *view_reset;
     GtkWidget *view_subpixel;
     GtkWidget *show_subpixel_mask;
+    GtkWidget *direct_rendering;
+    GtkWidget *coverage_masking;
 
     GtkWidget *goto_glyph_index;
     GtkWidget *goto_char;
+    GtkWidget *show_stats;
   } _menu_widgets;
 
 
@@ -52,6 +70,18 @@
   } _control_status;
 
 
+  /* Font being opened in the background */
+  static struct FontOpenStatus
+  {
+    FontOpenTask *task;
+    guint         timeout_id;
+
+    GtkWidget    *progress_box;
+    GtkWidget    *progress_bar;
+    GtkWidget    *cancel;
+  } _font_open;
+
+
   static void
   _menu_font_size_set_enabled( gboolean enabled );
 
@@ -95,51 +125,135 @@
 
   /*
    * Open font handler
+   *
+   * The file is read and checked by a background task while a progress bar
+   * with a cancel button is shown under the drawing area. The viewer's face
+   * is only made once the task has finished.
    */
 
+  static void
+  _show_message( const char *msg )
+  {
+    GtkWidget *message_box;
+
+    message_box = gtk_message_dialog_new ( GTK_WINDOW( globals.window ),
+                                           GTK_DIALOG_DESTROY_WITH_PARENT,
+                                           GTK_MESSAGE_ERROR,
+                                           GTK_BUTTONS_CLOSE,
+                                           "%s", msg );
+
+    gtk_dialog_run( GTK_DIALOG( message_box ) );
+    gtk_widget_destroy( message_box );
+  }
+
+
+  /* Hide the progress bar once the task is finished or cancelled. */
+  static void
+  _end_font_open()
+  {
+    struct FontOpenStatus *fo = &_font_open;
+
+    if( fo->timeout_id )
+      g_source_remove( fo->timeout_id );
+
+    fo->timeout_id = 0;
+    fo->task = NULL;
+
+    gtk_widget_hide( fo->progress_box );
+  }
+
+
   static gboolean
-  _do_open_index( char *filename, FT_Long num_faces, FT_Face *face )
+  _update_font_open_progress( gpointer data )
   {
-    GArray *faces;
-    gint index;
+    struct FontOpenStatus *fo = &_font_open;
 
-    faces = g_array_sized_new( FALSE, FALSE, sizeof( FT_Face ), num_faces );
+    gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR( fo->progress_bar ),
+                                   font_file_get_open_progress( fo->task ) );
+    return TRUE;
+  }
 
-    for( int i = 0; i < num_faces; i++ )
-    {
-      FT_Face _f;
 
-      if( FT_New_Face( globals.library, filename, i, &_f ) )
-        panic( "Couldn't load face index: %d, of %s", i, filename );
+  static void
+  _font_open_cancel( GtkButton *button, gpointer user_data )
+  {
+    if( !_font_open.task )
+      return;
 
-      g_array_append_val( faces, _f );
-    }
+    font_file_cancel_open( _font_open.task );
+    _end_font_open();
+  }
 
-    if( select_face_dialog_run( faces ) != GTK_RESPONSE_OK )
-      return TRUE;
+
+  /*
+   * Let the user pick a face from a collection. Returns the index or -1 if
+   * they cancelled.
+   */
+  static gint
+  _do_open_index( GPtrArray *names )
+  {
+    gint index;
+
+    if( select_face_dialog_run( names ) != GTK_RESPONSE_OK )
+      return -1;
 
     index = select_face_dialog_get_index();
 
     if( index == -1 )
       panic( "_do_open_index: No active index was set" );
 
-    for( int i = 0; i < num_faces; i++ )
+    return index;
+  }
+
+
+  /* The background task is done, make the face and switch to it. */
+  static void
+  _font_opened( FontOpenTask *task, gpointer user_data )
+  {
+    FT_Long index = 0;
+    FT_Face face;
+
+    _end_font_open();
+
+    if( task->error )
+    {
+      _show_message( "Error Opening File." );
+      return;
+    }
+
+    if( task->num_faces > 1 )
     {
-      FT_Face *_f = &g_array_index( faces, FT_Face, i );
+      index = _do_open_index( task->names );
 
-      if( i != index )
-        FT_Done_Face( *_f );
-      else
-        *face = *_f;
+      if( index == -1 )
+        return;
     }
 
-    g_array_free( faces, TRUE );
-    return FALSE;
+    /* The file's already in memory so only this face needs parsed here */
+    if( font_file_new_face( globals.library, task->file, index, &face ) )
+    {
+      _show_message( "Error Opening File." );
+      return;
+    }
+
+    switch_font( face, task->filename );
+    _menu_font_size_set_enabled( TRUE );
+    _menu_glyph_index_set_enabled( TRUE );
+    _menu_goto_glyph_index_enabled( TRUE );
+    _menu_view_controls_enabled( TRUE );
+
+    if( FT_Select_Charmap( globals.face, FT_ENCODING_UNICODE ) )
+      _show_message( "No unicode charmap found in the font." );
+    else
+      _menu_goto_char_enabled( TRUE );
   }
 
+
   static void
   _do_open_font()
   {
+    struct FontOpenStatus *fo = &_font_open;
+
     GtkWidget *chooser = gtk_file_chooser_dialog_new(
                              "Open",
                              GTK_WINDOW( globals.window ),
@@ -151,63 +265,21 @@
     if( gtk_dialog_run( GTK_DIALOG( chooser ) ) == GTK_RESPONSE_ACCEPT )
     {
       char *filename;
-      GtkWidget *message_box;
-      FT_Error error;
-      FT_Face face;
-
-      gboolean cancelled = FALSE;
 
       filename = gtk_file_chooser_get_filename( GTK_FILE_CHOOSER( chooser ) );
 
-      error = FT_New_Face( globals.library, filename, 0, &face );
-
-      if( error == 0 && face->num_faces > 1 )
-      {
-        FT_Long num_faces = face->num_faces;
-
-        FT_Done_Face( face );
-        cancelled = _do_open_index( filename, num_faces, &face );
-      }
-
-      if( error == 0 && !cancelled )
-      {
-        switch_font( face );
-        _menu_font_size_set_enabled( TRUE );
-        _menu_glyph_index_set_enabled( TRUE );
-        _menu_goto_glyph_index_enabled( TRUE );
-        _menu_view_controls_enabled( TRUE );
-
-        error = FT_Select_Charmap( globals.face, FT_ENCODING_UNICODE );
-        if( error )
-        {
-          char *msg = "No unicode charmap found in the font.";
-          message_box = gtk_message_dialog_new ( GTK_WINDOW( globals.window ),
-                                       GTK_DIALOG_DESTROY_WITH_PARENT,
-                                       GTK_MESSAGE_ERROR,
-                                       GTK_BUTTONS_CLOSE,
-                                       msg );
-
-          gtk_dialog_run( GTK_DIALOG( message_box ) );
-          gtk_widget_destroy( message_box );
-        }
-        else
-        {
-          _menu_goto_char_enabled( TRUE );
-        }
-
-        g_free( filename );
-      }
-      else if( !cancelled )
-      {
-        message_box = gtk_message_dialog_new ( GTK_WINDOW( globals.window ),
-                                       GTK_DIALOG_DESTROY_WITH_PARENT,
-                                       GTK_MESSAGE_ERROR,
-                                       GTK_BUTTONS_CLOSE,
-                                       "Error Opening File." );
-
-        gtk_dialog_run( GTK_DIALOG( message_box ) );
-        gtk_widget_destroy( message_box );
-      }
+      /* Only the latest file asked for is opened */
+      if( fo->task )
+        _font_open_cancel( NULL, NULL );
+
+      fo->task = font_file_open_async( filename, _font_opened, NULL );
+      fo->timeout_id = g_timeout_add( FONT_OPEN_PROGRESS_INTERVAL,
+                                      _update_font_open_progress, NULL );
+
+      gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR( fo->progress_bar ), 0 );
+      gtk_widget_show( fo->progress_box );
+
+      g_free( filename );
     }
 
     gtk_widget_destroy( chooser );
@@ -246,7 +318,7 @@
     globals.text_size = (unsigned int)size;
 
     set_face_size();
-    setup_glyph();
+    invalidate_glyph( INVALIDATE_RASTER );
   }
 
   static void
@@ -283,16 +355,14 @@
 
     globals.hinting_mode = mode;
 
-    if( globals.face )
-      setup_glyph();
+    invalidate_glyph( INVALIDATE_RASTER );
   }
 
   static void
   _menu_font_force_autohint( GtkMenuItem *menuitem, gpointer user_data )
   {
     globals.force_autohint = globals.force_autohint ? FALSE : TRUE;
-    if( globals.face )
-      setup_glyph();
+    invalidate_glyph( INVALIDATE_RASTER );
   }
 
   static void
@@ -330,7 +400,7 @@
       return;
 
     globals.glyph_index = index;
-    setup_glyph();
+    invalidate_glyph( INVALIDATE_RASTER );
   }
 
   static void
@@ -361,8 +431,7 @@
       _menu_gamma_change_set_enabled( TRUE );
     }
 
-    if( globals.face )
-      setup_glyph();
+    invalidate_glyph( INVALIDATE_COMPOSITE );
   }
 
   static void
@@ -380,10 +449,19 @@
       return;
 
     globals.gamma = gamma;
-    calculate_gamma_tables();
 
-    if( globals.face )
-      setup_glyph();
+    invalidate_glyph( INVALIDATE_COMPOSITE );
+  }
+
+  static void
+  _menu_gamma_precision_toggle( GtkMenuItem *menuitem, gpointer user_data )
+  {
+    if( globals.gamma_linear_bits == GAMMA_LINEAR_BITS )
+      globals.gamma_linear_bits = GAMMA_LINEAR_BITS_HIGH;
+    else
+      globals.gamma_linear_bits = GAMMA_LINEAR_BITS;
+
+    invalidate_glyph( INVALIDATE_COMPOSITE );
   }
 
   static void
@@ -391,6 +469,7 @@
   {
     gtk_widget_set_sensitive( _menu_widgets.gamma_inc, enabled );
     gtk_widget_set_sensitive( _menu_widgets.gamma_dec, enabled );
+    gtk_widget_set_sensitive( _menu_widgets.gamma_high_precision, enabled );
   }
 
 
@@ -453,10 +532,58 @@
     else
       return;
 
+    globals.lcd_filter = filter;
     FT_Library_SetLcdFilter( globals.library, filter );
 
-    if( globals.face )
-      setup_glyph();
+    invalidate_glyph( INVALIDATE_RASTER );
+  }
+
+  static void
+  _menu_prefetch_depth( GtkMenuItem *menuitem, gpointer user_data )
+  {
+    struct MenuWidgets *mw = &_menu_widgets;
+
+    if( !gtk_check_menu_item_get_active( GTK_CHECK_MENU_ITEM( menuitem ) ) )
+      return;
+
+    if( ((void*)menuitem) == ((void*)(mw->prefetch_off)) )
+      globals.prefetch_depth = 0;
+    else if( ((void*)menuitem) == ((void*)(mw->prefetch_1)) )
+      globals.prefetch_depth = 1;
+    else if( ((void*)menuitem) == ((void*)(mw->prefetch_2)) )
+      globals.prefetch_depth = 2;
+    else if( ((void*)menuitem) == ((void*)(mw->prefetch_4)) )
+      globals.prefetch_depth = 4;
+  }
+
+  static void
+  _menu_cache_size( GtkMenuItem *menuitem, gpointer user_data )
+  {
+    struct MenuWidgets *mw = &_menu_widgets;
+
+    if( !gtk_check_menu_item_get_active( GTK_CHECK_MENU_ITEM( menuitem ) ) )
+      return;
+
+    if( ((void*)menuitem) == ((void*)(mw->cache_size_8)) )
+      globals.glyph_cache_budget = 8 * 1024 * 1024;
+    else if( ((void*)menuitem) == ((void*)(mw->cache_size_32)) )
+      globals.glyph_cache_budget = 32 * 1024 * 1024;
+    else if( ((void*)menuitem) == ((void*)(mw->cache_size_128)) )
+      globals.glyph_cache_budget = 128 * 1024 * 1024;
+    else
+      return;
+
+    /* Shrinking evicts straight away, the displayed glyph keeps its own */
+    /* reference so it isn't affected                                    */
+    glyph_cache_set_budget( globals.glyph_cache_budget );
+  }
+
+  static void
+  _menu_toggle_ft_cache( GtkMenuItem *menuitem, gpointer user_data )
+  {
+    /* Glyphs come out the same, only new requests need to know */
+    glyph_rasterizer_set_use_ft_cache(
+        gtk_check_menu_item_get_active( GTK_CHECK_MENU_ITEM( menuitem ) ) );
   }
 
   static void
@@ -505,7 +632,7 @@
       return;
 
     globals.scale = scale;
-    setup_glyph();
+    invalidate_glyph( INVALIDATE_VIEW );
   }
 
   static void
@@ -514,7 +641,7 @@
     globals.scale = globals.scale_0;
     globals.x_origin = globals.x_origin_0;
     globals.y_origin = globals.y_origin_0;
-    setup_glyph();
+    invalidate_glyph( INVALIDATE_VIEW );
   }
 
   static void
@@ -537,8 +664,7 @@
   {
     globals.lcd_rendering = globals.lcd_rendering ? FALSE : TRUE;
 
-    if( globals.face )
-      setup_glyph();
+    invalidate_glyph( INVALIDATE_RASTER );
   }
 
   static void
@@ -546,8 +672,23 @@
   {
     globals.show_subpixel_mask = globals.show_subpixel_mask ? FALSE : TRUE;
 
-    if( globals.face )
-      setup_glyph();
+    invalidate_glyph( INVALIDATE_COMPOSITE );
+  }
+
+  static void
+  _menu_toggle_direct_rendering( GtkMenuItem *menuitem, gpointer user_data )
+  {
+    globals.direct_rendering = globals.direct_rendering ? FALSE : TRUE;
+
+    invalidate_glyph( INVALIDATE_RASTER );
+  }
+
+  static void
+  _menu_toggle_coverage_masking( GtkMenuItem *menuitem, gpointer user_data )
+  {
+    globals.coverage_masking = globals.coverage_masking ? FALSE : TRUE;
+
+    invalidate_glyph( INVALIDATE_RASTER );
   }
 
   static void
@@ -576,7 +717,7 @@
       return;
 
     globals.glyph_index = index;
-    setup_glyph();
+    invalidate_glyph( INVALIDATE_RASTER );
   }
 
   static void
@@ -598,7 +739,7 @@
       return;
 
     globals.glyph_index = FT_Get_Char_Index( globals.face, (FT_ULong)unichar );
-    setup_glyph();
+    invalidate_glyph( INVALIDATE_RASTER );
   }
 
   static void
@@ -607,6 +748,93 @@
     gtk_widget_set_sensitive( _menu_widgets.goto_char, enabled );
   }
 
+  static void
+  _menu_show_stats( GtkMenuItem *menuitem, gpointer user_data )
+  {
+    GtkWidget *message_box;
+    GlyphCacheStats cache;
+    BlendStats blend;
+    GlyphRasterizerStats rasterizer;
+    RenderStats render;
+    double total_pixels;
+    GString *s = g_string_new( "" );
+
+    glyph_cache_get_stats( &cache );
+    get_blend_stats( &blend );
+    glyph_rasterizer_get_stats( &rasterizer );
+    get_render_stats( &render );
+
+    total_pixels = (double) blend.empty_pixels + blend.full_pixels +
+                   blend.partial_pixels;
+    if( total_pixels == 0 )
+      total_pixels = 1;
+
+    g_string_append_printf( s,
+        "Glyph cache:\n"
+        "  Hits: %" G_GUINT64_FORMAT "\n"
+        "  Hits on prefetched glyphs: %" G_GUINT64_FORMAT "\n"
+        "  Misses: %" G_GUINT64_FORMAT "\n"
+        "  Evictions: %" G_GUINT64_FORMAT "\n"
+        "  Entries: %u\n"
+        "  Memory: %" G_GSIZE_FORMAT " / %" G_GSIZE_FORMAT " KiB\n"
+        "\n"
+        "Blending kernels: %s\n"
+        "  Empty pixels: %.1f%%\n"
+        "  Filled pixels: %.1f%%\n"
+        "  Blended pixels: %.1f%%\n"
+        "\n"
+        "Rasterizer threads: %u\n"
+        "  Completed: %" G_GUINT64_FORMAT "\n"
+        "  Superseded: %" G_GUINT64_FORMAT "\n"
+        "  Prefetched: %" G_GUINT64_FORMAT " (%.1f%% used)\n"
+        "\n"
+        "Freetype cache: %s, %" G_GSIZE_FORMAT " KiB\n"
+        "  Faces loaded: %" G_GUINT64_FORMAT "\n"
+        "  Sizes: %" G_GUINT64_FORMAT " lookups, %" G_GUINT64_FORMAT
+          " loaded\n"
+        "  Images: %" G_GUINT64_FORMAT " lookups, %" G_GUINT64_FORMAT
+          " loaded\n"
+        "  Bitmaps: %" G_GUINT64_FORMAT " lookups, %" G_GUINT64_FORMAT
+          " rendered\n"
+        "\n"
+        "Glyph requests: %" G_GUINT64_FORMAT "\n"
+        "  Shown: %" G_GUINT64_FORMAT "\n"
+        "  Over one frame: %" G_GUINT64_FORMAT "\n"
+        "  Latency: %.1f ms last, %.1f ms mean, %.1f ms max",
+        cache.hits, cache.prefetch_hits, cache.misses, cache.evictions,
+        cache.num_entries,
+        cache.bytes_used / 1024, cache.budget / 1024,
+        get_blend_kernels_name(),
+        100.0 * blend.empty_pixels / total_pixels,
+        100.0 * blend.full_pixels / total_pixels,
+        100.0 * blend.partial_pixels / total_pixels,
+        rasterizer.num_workers, rasterizer.completed, rasterizer.cancelled,
+        rasterizer.prefetched,
+        rasterizer.prefetched
+          ? 100.0 * cache.prefetch_hits / rasterizer.prefetched : 0.0,
+        rasterizer.ft_cache_enabled ? "on" : "off",
+        rasterizer.ft_cache_budget / 1024,
+        rasterizer.ft_face_loads,
+        rasterizer.ft_size_lookups, rasterizer.ft_size_loads,
+        rasterizer.ft_image_lookups, rasterizer.ft_image_loads,
+        rasterizer.ft_bitmap_lookups, rasterizer.ft_bitmap_renders,
+        render.requests, render.shown, render.over_frame,
+        render.last_latency / 1000.0,
+        render.shown ? render.total_latency / 1000.0 / render.shown : 0.0,
+        render.max_latency / 1000.0 );
+
+    message_box = gtk_message_dialog_new( GTK_WINDOW( globals.window ),
+                                          GTK_DIALOG_DESTROY_WITH_PARENT,
+                                          GTK_MESSAGE_INFO,
+                                          GTK_BUTTONS_CLOSE,
+                                          "%s", s->str );
+
+    gtk_dialog_run( GTK_DIALOG( message_box ) );
+    gtk_widget_destroy( message_box );
+
+    g_string_free( s, TRUE );
+  }
+
 
 
   /*************************************************************************/
@@ -627,6 +855,7 @@
       status = gdk_pointer_grab( gtk_widget_get_window( event_box ),
                                  FALSE,
                                  GDK_POINTER_MOTION_MASK |
+                                 GDK_POINTER_MOTION_HINT_MASK |
                                  GDK_BUTTON_RELEASE_MASK,
                                  NULL,
                                  NULL,
@@ -667,7 +896,7 @@
 
   static void
   _drawing_area_grab_motion( GtkWidget      *event_box,
-                             GdkEventButton *event,
+                             GdkEventMotion *event,
                              gpointer        data )
   {
     if( _control_status.mouse_grabbed )
@@ -695,10 +924,12 @@
       else if ( y_origin + y_delta < -alloc.height * 1.5 )
         y_delta = (int)( -alloc.height * 1.5 ) - y_origin;
 
-      globals.x_origin = _control_status.start_x + x_delta;
-      globals.y_origin = _control_status.start_y + y_delta;
+      pan_drawing_area( _control_status.start_x + x_delta,
+                        _control_status.start_y + y_delta );
 
-      invalidate_drawing_area();
+      /* Motion events are hints, only ask for the next one once this */
+      /* one's handled so they don't queue up behind the redraws      */
+      gdk_event_request_motions( event );
     }
   }
 
@@ -829,6 +1060,11 @@
                                 0,
                                 GTK_ACCEL_VISIBLE);
 
+    /* High Precision Linear Blending */
+    mw->gamma_high_precision = get_builder_widget( "gamma_high_precision" );
+    _activate_handler( mw->gamma_high_precision,
+                       _menu_gamma_precision_toggle );
+
     /* Show Pixel Grid */
     mw->show_grid = get_builder_widget( "show_grid" );
     _activate_handler( mw->show_grid, _menu_toggle_grid );
@@ -847,6 +1083,33 @@
     mw->lcd_filter_normal = get_builder_widget( "lcd_filter_normal" );
     _activate_handler( mw->lcd_filter_normal, _menu_lcd_filter );
 
+    /* Prefetch Depth */
+    mw->prefetch_off = get_builder_widget( "prefetch_off" );
+    _activate_handler( mw->prefetch_off, _menu_prefetch_depth );
+
+    mw->prefetch_1 = get_builder_widget( "prefetch_1" );
+    _activate_handler( mw->prefetch_1, _menu_prefetch_depth );
+
+    mw->prefetch_2 = get_builder_widget( "prefetch_2" );
+    _activate_handler( mw->prefetch_2, _menu_prefetch_depth );
+
+    mw->prefetch_4 = get_builder_widget( "prefetch_4" );
+    _activate_handler( mw->prefetch_4, _menu_prefetch_depth );
+
+    /* Glyph Cache Size */
+    mw->cache_size_8 = get_builder_widget( "cache_size_8" );
+    _activate_handler( mw->cache_size_8, _menu_cache_size );
+
+    mw->cache_size_32 = get_builder_widget( "cache_size_32" );
+    _activate_handler( mw->cache_size_32, _menu_cache_size );
+
+    mw->cache_size_128 = get_builder_widget( "cache_size_128" );
+    _activate_handler( mw->cache_size_128, _menu_cache_size );
+
+    /* Freetype cache backend */
+    mw->ft_cache_backend = get_builder_widget( "ft_cache_backend" );
+    _activate_handler( mw->ft_cache_backend, _menu_toggle_ft_cache );
+
 
     /* --------- */
     /* View Menu */
@@ -893,6 +1156,14 @@
     mw->show_subpixel_mask = get_builder_widget( "show_subpixel_mask" );
     _activate_handler( mw->show_subpixel_mask, _menu_toggle_subpixel_mask );
 
+    /* Render Spans Directly */
+    mw->direct_rendering = get_builder_widget( "direct_rendering" );
+    _activate_handler( mw->direct_rendering, _menu_toggle_direct_rendering );
+
+    /* Composite With Cairo Mask */
+    mw->coverage_masking = get_builder_widget( "coverage_masking" );
+    _activate_handler( mw->coverage_masking, _menu_toggle_coverage_masking );
+
 
     /* ---------- */
     /* Tools Menu */
@@ -905,6 +1176,10 @@
     /* Goto Char */
     mw->goto_char = get_builder_widget( "goto_char" );
     _activate_handler( mw->goto_char, _menu_goto_char );
+
+    /* Render Statistics */
+    mw->show_stats = get_builder_widget( "show_stats" );
+    _activate_handler( mw->show_stats, _menu_show_stats );
   }
 
 
@@ -942,6 +1217,13 @@
     goto_index_dialog_init();
     goto_char_dialog_init();
     select_face_dialog_init();
+
+    _font_open.progress_box = get_builder_widget( "open_progress_box" );
+    _font_open.progress_bar = get_builder_widget( "open_progress_bar" );
+    _font_open.cancel = get_builder_widget( "open_progress_cancel" );
+
+    g_signal_connect( G_OBJECT( _font_open.cancel ), "clicked",
+                      G_CALLBACK( _font_open_cancel ), NULL );
   }
 
 
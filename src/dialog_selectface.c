@@ -14,33 +14,27 @@ select_face_dialog_get_index()
 }
 
 
+/*
+ * Let the user pick from a list of face names, the array holds one string
+ * per face index.
+ */
 gint
-select_face_dialog_run( GArray *faces )
+select_face_dialog_run( GPtrArray *names )
 {
   gint response;
   GtkTreeIter iter;
-  GString *s = g_string_new( "" );
 
   /* Setup the new list of faces */
 
   gtk_list_store_clear( store );
 
-  for( int i = 0; i < faces->len; i++ )
+  for( int i = 0; i < names->len; i++ )
   {
-    FT_Face *face = &g_array_index( faces, FT_Face, i );
-
-    /* Clear the string, keep the buffer */
-    g_string_truncate( s, 0 );
-
-    /* Make name string */
-    g_string_printf( s, "%s %s", face[0]->family_name, face[0]->style_name );
-
     /* Add new element */
     gtk_list_store_append( store, &iter );
-    gtk_list_store_set( store, &iter, 0, s->str, -1 );
+    gtk_list_store_set( store, &iter, 0, g_ptr_array_index( names, i ), -1 );
   }
 
-  g_string_free( s, TRUE );
   gtk_combo_box_set_active( combo, 0 );
 
   response = gtk_dialog_run( dialog );
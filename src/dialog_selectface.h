@@ -10,7 +10,7 @@ gint
 select_face_dialog_get_index();
 
 gint
-select_face_dialog_run( GArray *faces );
+select_face_dialog_run( GPtrArray *names );
 
 void
 select_face_dialog_init();
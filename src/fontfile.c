@@ -0,0 +1,504 @@
+#include "fontfile.h"
+#include "utils.h"
+
+#include <string.h>
+
+
+/* Name ids and platforms from the OpenType name table */
+#define NAME_ID_FAMILY             1
+#define NAME_ID_STYLE              2
+#define NAME_ID_TYPOGRAPHIC_FAMILY 16
+#define NAME_ID_TYPOGRAPHIC_STYLE  17
+
+#define PLATFORM_UNICODE           0
+#define PLATFORM_MACINTOSH         1
+#define PLATFORM_WINDOWS           3
+
+#define LANGUAGE_WINDOWS_ENGLISH   0x0409
+
+
+  /* Called by Freetype when a face is done, drops its mapping reference. */
+  static void
+  _finalize_face( void *object )
+  {
+    FT_Face face = object;
+
+    g_mapped_file_unref( face->generic.data );
+  }
+
+
+  /*
+   * Map a font file read only. Returns a mapping with a single reference for
+   * the caller or NULL with the error set.
+   */
+  GMappedFile *
+  font_file_open( const char *filename, GError **error )
+  {
+    return g_mapped_file_new( filename, FALSE, error );
+  }
+
+
+  /*
+   * Open a face from a mapped font file. The face takes its own reference to
+   * the mapping, the caller's is untouched.
+   */
+  FT_Error
+  font_file_new_face( FT_Library     library,
+                      GMappedFile   *file,
+                      FT_Long        face_index,
+                      FT_Face       *face )
+  {
+    const FT_Byte *data = (const FT_Byte *) g_mapped_file_get_contents( file );
+    FT_Long size = (FT_Long) g_mapped_file_get_length( file );
+    FT_Error error;
+
+    error = FT_New_Memory_Face( library, data, size, face_index, face );
+    if( error )
+      return error;
+
+    ( *face )->generic.data = g_mapped_file_ref( file );
+    ( *face )->generic.finalizer = _finalize_face;
+
+    return 0;
+  }
+
+
+  /* The mapping a face opened with font_file_new_face() reads from. */
+  GMappedFile *
+  font_file_get_for_face( FT_Face face )
+  {
+    return face->generic.data;
+  }
+
+
+  /* -------------------------------------------------------------------------- *\
+   *
+   *                            == Name table ==
+   *
+  \* -------------------------------------------------------------------------- */
+
+  /*
+   * Face names for a collection are read straight from the sfnt tables so the
+   * face picker doesn't need to create a FT_Face for every face in the file.
+   * Everything is bounds checked since the file could be anything.
+   */
+
+  static guint16
+  _read_u16( const guchar *p )
+  {
+    return (guint16)( p[0] << 8 | p[1] );
+  }
+
+
+  static guint32
+  _read_u32( const guchar *p )
+  {
+    return (guint32) p[0] << 24 | (guint32) p[1] << 16 |
+           (guint32) p[2] << 8  | (guint32) p[3];
+  }
+
+
+  /* Is the range offset..offset+length inside the file? */
+  static gboolean
+  _in_file( gsize size, guint32 offset, guint32 length )
+  {
+    return offset <= size && length <= size - offset;
+  }
+
+
+  /* Find a table of the font whose table directory is at font_offset. */
+  static gboolean
+  _find_table( const guchar  *data,
+               gsize          size,
+               guint32        font_offset,
+               const char    *tag,
+               guint32       *offset,
+               guint32       *length )
+  {
+    guint16 num_tables;
+
+    if( !_in_file( size, font_offset, 12 ) )
+      return FALSE;
+
+    num_tables = _read_u16( data + font_offset + 4 );
+
+    if( !_in_file( size, font_offset + 12, num_tables * 16 ) )
+      return FALSE;
+
+    for( guint16 i = 0; i < num_tables; i++ )
+    {
+      const guchar *record = data + font_offset + 12 + i * 16;
+
+      if( memcmp( record, tag, 4 ) != 0 )
+        continue;
+
+      *offset = _read_u32( record + 8 );
+      *length = _read_u32( record + 12 );
+
+      return _in_file( size, *offset, *length );
+    }
+
+    return FALSE;
+  }
+
+
+  /* How good a name record's platform and language are, 0 if unusable. */
+  static int
+  _rate_name_record( guint16 platform, guint16 encoding, guint16 language )
+  {
+    if( platform == PLATFORM_WINDOWS && ( encoding == 0  ||
+                                          encoding == 1  ||
+                                          encoding == 10 ) )
+      return language == LANGUAGE_WINDOWS_ENGLISH ? 4 : 3;
+
+    if( platform == PLATFORM_UNICODE )
+      return 2;
+
+    if( platform == PLATFORM_MACINTOSH && encoding == 0 && language == 0 )
+      return 1;
+
+    return 0;
+  }
+
+
+  /* Convert a name string to UTF-8, NULL if it can't be. */
+  static gchar *
+  _decode_name( guint16 platform, const guchar *string, guint16 length )
+  {
+    gunichar2 *utf16;
+    gchar *name;
+
+    if( platform == PLATFORM_MACINTOSH )
+      return g_convert( (const gchar *) string, length,
+                        "UTF-8", "MACINTOSH", NULL, NULL, NULL );
+
+    /* The others are UTF-16 big endian */
+    utf16 = g_new( gunichar2, length / 2 + 1 );
+
+    for( guint16 i = 0; i < length / 2; i++ )
+      utf16[i] = _read_u16( string + i * 2 );
+
+    name = g_utf16_to_utf8( utf16, length / 2, NULL, NULL, NULL );
+    g_free( utf16 );
+
+    return name;
+  }
+
+
+  /* Read the best name for an id from the name table, NULL if missing. */
+  static gchar *
+  _read_name( const guchar  *data,
+              guint32        table_offset,
+              guint32        table_length,
+              guint16        name_id )
+  {
+    const guchar *table = data + table_offset;
+    const guchar *best = NULL;
+    int best_rating = 0;
+    guint16 count, string_offset;
+
+    if( table_length < 6 )
+      return NULL;
+
+    count = _read_u16( table + 2 );
+    string_offset = _read_u16( table + 4 );
+
+    if( !_in_file( table_length, 6, count * 12 ) )
+      return NULL;
+
+    for( guint16 i = 0; i < count; i++ )
+    {
+      const guchar *record = table + 6 + i * 12;
+      int rating;
+
+      if( _read_u16( record + 6 ) != name_id )
+        continue;
+
+      rating = _rate_name_record( _read_u16( record ),
+                                  _read_u16( record + 2 ),
+                                  _read_u16( record + 4 ) );
+
+      if( rating > best_rating &&
+          _in_file( table_length,
+                    (guint32) string_offset + _read_u16( record + 10 ),
+                    _read_u16( record + 8 ) ) )
+      {
+        best = record;
+        best_rating = rating;
+      }
+    }
+
+    if( !best )
+      return NULL;
+
+    return _decode_name( _read_u16( best ),
+                         table + string_offset + _read_u16( best + 10 ),
+                         _read_u16( best + 8 ) );
+  }
+
+
+  /* "Family Style", or just the family without a style. NULL without one. */
+  static gchar *
+  _format_face_name( const char *family, const char *style )
+  {
+    if( !family || !*family )
+      return NULL;
+
+    if( !style || !*style )
+      return g_strdup( family );
+
+    return g_strdup_printf( "%s %s", family, style );
+  }
+
+
+  /*
+   * Get the "family style" name of a face in a font file (a collection or a
+   * single sfnt font) from its name table without opening it with Freetype.
+   * The typographic names are preferred over the legacy ones. Returns a new
+   * string or NULL if the name couldn't be read, for other font formats say.
+   */
+  gchar *
+  font_file_get_face_name( GMappedFile *file, FT_Long face_index )
+  {
+    const guchar *data = (const guchar *) g_mapped_file_get_contents( file );
+    gsize size = g_mapped_file_get_length( file );
+    guint32 font_offset = 0;
+    guint32 name_offset, name_length;
+    gchar *family, *style, *name;
+
+    if( size < 12 || face_index < 0 )
+      return NULL;
+
+    if( memcmp( data, "ttcf", 4 ) == 0 )
+    {
+      if( face_index >= _read_u32( data + 8 ) ||
+          !_in_file( size, 12 + face_index * 4, 4 ) )
+        return NULL;
+
+      font_offset = _read_u32( data + 12 + face_index * 4 );
+    }
+    else if( face_index != 0 )
+      return NULL;
+
+    if( !_find_table( data, size, font_offset, "name",
+                      &name_offset, &name_length ) )
+      return NULL;
+
+    family = _read_name( data, name_offset, name_length,
+                         NAME_ID_TYPOGRAPHIC_FAMILY );
+    if( family )
+      style = _read_name( data, name_offset, name_length,
+                          NAME_ID_TYPOGRAPHIC_STYLE );
+    else
+    {
+      family = _read_name( data, name_offset, name_length, NAME_ID_FAMILY );
+      style = NULL;
+    }
+
+    if( !style )
+      style = _read_name( data, name_offset, name_length, NAME_ID_STYLE );
+
+    name = _format_face_name( family, style );
+
+    g_free( family );
+    g_free( style );
+
+    return name;
+  }
+
+
+  /* -------------------------------------------------------------------------- *\
+   *
+   *                        == Background opening ==
+   *
+  \* -------------------------------------------------------------------------- */
+
+  static void
+  _set_progress( FontOpenTask *task, double fraction )
+  {
+    g_atomic_int_set( &task->progress, (gint)( fraction * 1000 ) );
+  }
+
+
+  static gboolean
+  _is_cancelled( FontOpenTask *task )
+  {
+    return g_atomic_int_get( &task->cancelled );
+  }
+
+
+  /*
+   * Touch every page of the mapping so the main thread doesn't stall on disk
+   * reads when the face is made. Returns FALSE if cancelled part way.
+   */
+  static gboolean
+  _page_in( FontOpenTask *task )
+  {
+    const volatile guchar *data =
+        (const guchar *) g_mapped_file_get_contents( task->file );
+    gsize size = g_mapped_file_get_length( task->file );
+    guchar sum = 0;
+
+    for( gsize chunk = 0; chunk < size; chunk += FONT_FILE_PAGE_IN_CHUNK )
+    {
+      gsize end = MIN( size, chunk + FONT_FILE_PAGE_IN_CHUNK );
+
+      if( _is_cancelled( task ) )
+        return FALSE;
+
+      for( gsize i = chunk; i < end; i += 4096 )
+        sum ^= data[i];
+
+      /* Reading the file is most of the work */
+      _set_progress( task, 0.9 * end / size );
+    }
+
+    (void) sum;
+    return TRUE;
+  }
+
+
+  /* Check the file is a font and get the face names if it's a collection. */
+  static void
+  _read_faces( FontOpenTask *task )
+  {
+    FT_Library library;
+    FT_Face face;
+
+    if( FT_Init_FreeType( &library ) )
+      panic( "Couldn't initalize Freetype for opening fonts" );
+
+    if( font_file_new_face( library, task->file, 0, &face ) )
+    {
+      task->error = g_strdup( "The file isn't a font Freetype can open." );
+      FT_Done_FreeType( library );
+      return;
+    }
+
+    task->num_faces = face->num_faces;
+    FT_Done_Face( face );
+
+    if( task->num_faces > 1 )
+    {
+      task->names = g_ptr_array_new_with_free_func( g_free );
+
+      for( FT_Long i = 0; i < task->num_faces && !_is_cancelled( task ); i++ )
+      {
+        gchar *name = font_file_get_face_name( task->file, i );
+
+        /* Not a sfnt font, Freetype has to open it to find out */
+        if( !name && !font_file_new_face( library, task->file, i, &face ) )
+        {
+          name = _format_face_name( face->family_name, face->style_name );
+          FT_Done_Face( face );
+        }
+
+        g_ptr_array_add( task->names,
+                         name ? name : g_strdup_printf( "Face %ld", i ) );
+
+        _set_progress( task, 0.9 + 0.1 * ( i + 1 ) / task->num_faces );
+      }
+    }
+
+    FT_Done_FreeType( library );
+  }
+
+
+  static void
+  _free_open_task( FontOpenTask *task )
+  {
+    if( task->file )
+      g_mapped_file_unref( task->file );
+
+    if( task->names )
+      g_ptr_array_free( task->names, TRUE );
+
+    g_free( task->error );
+    g_free( task->filename );
+    g_free( task );
+  }
+
+
+  /* Back on the main loop, hand over the results. */
+  static gboolean
+  _open_finished( gpointer data )
+  {
+    FontOpenTask *task = data;
+
+    if( !_is_cancelled( task ) )
+      task->callback( task, task->user_data );
+
+    _free_open_task( task );
+
+    return FALSE;
+  }
+
+
+  static gpointer
+  _open_thread( gpointer data )
+  {
+    FontOpenTask *task = data;
+    GError *error = NULL;
+
+    task->file = font_file_open( task->filename, &error );
+
+    if( !task->file )
+    {
+      task->error = g_strdup( error->message );
+      g_error_free( error );
+    }
+    else if( _page_in( task ) )
+      _read_faces( task );
+
+    /* A font that couldn't be used isn't worth keeping mapped */
+    if( task->error && task->file )
+    {
+      g_mapped_file_unref( task->file );
+      task->file = NULL;
+    }
+
+    g_idle_add( _open_finished, task );
+
+    return NULL;
+  }
+
+
+  /*
+   * Start opening a font file in the background, the callback gets the
+   * results on the main loop. The task can be cancelled until then, but must
+   * not be used after either.
+   */
+  FontOpenTask *
+  font_file_open_async( const char      *filename,
+                        FontOpenedFunc   callback,
+                        gpointer         user_data )
+  {
+    FontOpenTask *task = g_new0( FontOpenTask, 1 );
+
+    task->filename = g_strdup( filename );
+    task->callback = callback;
+    task->user_data = user_data;
+
+    g_thread_unref( g_thread_new( "fontopen", _open_thread, task ) );
+
+    return task;
+  }
+
+
+  /* Stop a background open, its callback won't be called. */
+  void
+  font_file_cancel_open( FontOpenTask *task )
+  {
+    g_atomic_int_set( &task->cancelled, TRUE );
+  }
+
+
+  /* How far through a background open is, from 0 to 1. */
+  double
+  font_file_get_open_progress( FontOpenTask *task )
+  {
+    return g_atomic_int_get( &task->progress ) / 1000.0;
+  }
+
+
+/* END */
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include <glib.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#ifndef FONT_FILE_H_
+#define FONT_FILE_H_
+
+/*
+ * Memory mapped font files
+ *
+ * A font file is mapped once and every face opened on it (all the faces of a
+ * collection, and each rasterizer worker's copy) reads from the same pages
+ * instead of Freetype buffering the file for each one. The mapping is a
+ * reference counted GMappedFile, each face holds a reference that's dropped
+ * when the face is done, so the file stays mapped for as long as anything
+ * uses it.
+ *
+ * Opening can be done in the background: the file is mapped and paged in,
+ * checked with Freetype and the names of a collection's faces are read on a
+ * thread of its own, leaving the viewer's face to be made on the main thread
+ * from pages that are already in memory.
+ */
+
+/* Bytes paged in between checks for cancellation */
+#define FONT_FILE_PAGE_IN_CHUNK ( 256 * 1024 )
+
+
+  typedef struct FontOpenTaskRec_ FontOpenTask;
+
+  /*
+   * Called on the main loop when a background open finishes, the results
+   * are in the task which is freed once this returns. Not called for a
+   * cancelled task.
+   */
+  typedef void
+  (*FontOpenedFunc)( FontOpenTask  *task,
+                     gpointer       user_data );
+
+
+  struct FontOpenTaskRec_
+  {
+    char            *filename;
+
+    /* Results: the mapped file, NULL with error set if the file couldn't */
+    /* be opened as a font                                                 */
+    GMappedFile     *file;
+    gchar           *error;
+    FT_Long          num_faces;
+
+    /* Names of each face, only read for collections */
+    GPtrArray       *names;
+
+    /* Thousandths of the work done, set by the thread */
+    gint             progress;
+    gint             cancelled;
+
+    FontOpenedFunc   callback;
+    gpointer         user_data;
+  };
+
+
+  GMappedFile *
+  font_file_open( const char *filename, GError **error );
+
+  FT_Error
+  font_file_new_face( FT_Library     library,
+                      GMappedFile   *file,
+                      FT_Long        face_index,
+                      FT_Face       *face );
+
+  GMappedFile *
+  font_file_get_for_face( FT_Face face );
+
+  gchar *
+  font_file_get_face_name( GMappedFile *file, FT_Long face_index );
+
+  FontOpenTask *
+  font_file_open_async( const char      *filename,
+                        FontOpenedFunc   callback,
+                        gpointer         user_data );
+
+  void
+  font_file_cancel_open( FontOpenTask *task );
+
+  double
+  font_file_get_open_progress( FontOpenTask *task );
+
+
+#endif /* FONT_FILE_H_ */
+
+/* END */
\ No newline at end of file
@@ -1,17 +1,53 @@
 #include "glyphblending.h"
-#include "glyphviewerglobals.h"
+#include "glyphblending_kernels.h"
 #include "utils.h"
 
+#include <glib.h>
+
 #include FT_IMAGE_H
+#include FT_OUTLINE_H
 #include <math.h>
+#include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-  void
-  calculate_gamma_tables()
+
+/* -------------------------------------------------------------------------- *\
+ *
+ *                          == Gamma table store ==
+ *
+ * Gamma tables are built once per gamma/precision pair and never change or
+ * get freed after that, so any number of users can share them (from any
+ * thread) without copying. There are only ever a handful in use as the gamma
+ * is stepped in tenths.
+ *
+\* -------------------------------------------------------------------------- */
+
+
+  static struct
+  {
+    GMutex      lock;
+
+    /* All the GammaTables built so far */
+    GPtrArray  *tables;
+  } _gamma_store;
+
+
+  static GammaTables *
+  _build_gamma_tables( double gamma, unsigned int linear_bits )
   {
-    double gamma = globals.gamma;
+    GammaTables *tables = g_new0( GammaTables, 1 );
     double inv_gamma = 1.0 / gamma;
 
+    tables->gamma = gamma;
+    tables->linear_bits = linear_bits;
+    tables->linear_max = ( 1u << linear_bits ) - 1;
+
+    /* A multiple of 4 bytes so SIMD lookups can read whole words */
+    tables->from_linear = g_malloc0( ( ( tables->linear_max + 1 ) + 3 ) & ~3u );
+
     /* Conversion from gamma encoded to linear (decoded) */
     for( int i = 0; i < 256; i++ )
     {
@@ -19,20 +55,63 @@
 
       encoded_fraction = i / 255.0;
       decoded_fraction = pow( encoded_fraction, gamma );
-      globals.gamma_table[i] =
-          (unsigned short)round( decoded_fraction * GAMMA_LINEAR_MAX );
+      tables->to_linear[i] =
+          (unsigned short)round( decoded_fraction * tables->linear_max );
     }
 
     /* Conversion from linear to gamma encoded */
-    for( int i = 0; i < GAMMA_LINEAR_NUM_VALUES; i++ )
+    for( unsigned int i = 0; i <= tables->linear_max; i++ )
     {
       double decoded_fraction, encoded_fraction;
 
-      decoded_fraction = i / (double)GAMMA_LINEAR_MAX;
+      decoded_fraction = i / (double)tables->linear_max;
       encoded_fraction = pow( decoded_fraction, inv_gamma );
-      globals.gamma_inv_table[i] =
+      tables->from_linear[i] =
           (unsigned char)round( encoded_fraction * 255 );
     }
+
+    return tables;
+  }
+
+
+  /*
+   * Get the gamma tables for a gamma value with linear values of linear_bits
+   * bits (at most 16). The tables are built on first use and stay valid for
+   * the life of the program.
+   */
+  const GammaTables *
+  get_gamma_tables( double gamma, unsigned int linear_bits )
+  {
+    GammaTables *tables = NULL;
+
+    if( linear_bits < 8 || linear_bits > GAMMA_LINEAR_BITS_HIGH )
+      panic( "get_gamma_tables: unsupported precision %u", linear_bits );
+
+    g_mutex_lock( &_gamma_store.lock );
+
+    if( !_gamma_store.tables )
+      _gamma_store.tables = g_ptr_array_new();
+
+    for( guint i = 0; i < _gamma_store.tables->len; i++ )
+    {
+      GammaTables *t = g_ptr_array_index( _gamma_store.tables, i );
+
+      if( t->gamma == gamma && t->linear_bits == linear_bits )
+      {
+        tables = t;
+        break;
+      }
+    }
+
+    if( !tables )
+    {
+      tables = _build_gamma_tables( gamma, linear_bits );
+      g_ptr_array_add( _gamma_store.tables, tables );
+    }
+
+    g_mutex_unlock( &_gamma_store.lock );
+
+    return tables;
   }
 
 
@@ -47,78 +126,6 @@
 \* -------------------------------------------------------------------------- */
 
 
-/*
- * _BLENDING_LOOP
- *
- * Convert the glyph coverage (alpha) map into a rasterized glyph image with
- * specified color.
- * 
- * Params:
- *   dest - the destination bitmap. Should have the same width and height
- *          as the source bitmap (excluding any padding i.e width and pitch
- *          aren't the same).
- *
- *   src - the coverage bitmap output by freetype. The bitmap should either
- *         be a greyscale or RGB bitmap.
- *
- *   r, g, b - RGB color values to draw the glyph with. If using linear
- *             blending, these should be converted to linear values.
- *
- *   func - the blending macro/function to call per pixel.
- *
- * The source FT_Bitmap is expected to have a pixel mode of either
- * FT_PIXEL_MODE_GRAY (byte per pixel) or FT_PIXEL_MODE_LCD (3 bytes per pixel)
- * while the destination cairo surface is expected to be an image surface with
- * a format of CAIRO_FORMAT_RGB24 (4 bytes per pixel 0RGB in the platform's
- * native endian order).
- */
-#define _BLENDING_LOOP( dest, src, r, g, b, func )                           \
-  do {                                                                       \
-    unsigned int width, height, pitch, stride;                               \
-    unsigned char *data;                                                     \
-    unsigned char is_rgb, src_pix_bytes, _0, _1, _2;                         \
-                                                                             \
-    is_rgb = ( src->pixel_mode == FT_PIXEL_MODE_LCD ) ? 1 : 0;               \
-                                                                             \
-    if( is_rgb )                                                             \
-    {                                                                        \
-      width = src->width / 3;                                                \
-      src_pix_bytes = 3;                                                     \
-      _0 = 0;                                                                \
-      _1 = 1;                                                                \
-      _2 = 2;                                                                \
-    }                                                                        \
-    else                                                                     \
-    {                                                                        \
-      width = src->width;                                                    \
-      src_pix_bytes = 1;                                                     \
-      _0 = _1 = _2 = 0;                                                      \
-    }                                                                        \
-                                                                             \
-    height = src->rows;                                                      \
-    pitch = (unsigned int) abs( src->pitch );                                \
-    stride = (unsigned int) cairo_image_surface_get_stride( dest );          \
-    data = cairo_image_surface_get_data( dest );                             \
-                                                                             \
-    cairo_surface_flush( dest );                                             \
-                                                                             \
-    for( unsigned int y = 0; y < height; y++ )                               \
-    {                                                                        \
-      unsigned char* srow = ( (unsigned char*) src->buffer ) + y * pitch;    \
-      unsigned int* drow = (unsigned int*) ( data + y * stride );            \
-                                                                             \
-      for( unsigned int x = 0; x < width; x++ )                              \
-      {                                                                      \
-        unsigned char* spixel = srow + x * src_pix_bytes;                    \
-        unsigned int* dpixel = drow + x;                                     \
-        func( dpixel, spixel, _0, _1, _2, r, g, b );                         \
-      }                                                                      \
-    }                                                                        \
-                                                                             \
-    cairo_surface_mark_dirty( dest );                                        \
-  } while( 0 )
-
-
 /*
  * _ALPHA_BLEND
  *
@@ -170,9 +177,9 @@
  *   _0, _1, _2 - indices to access the source alpha map RGB values. For
  *                greyscale maps these should all be set to 0.
  *
- *   r, g, b - RGB color values to draw the glyph with.
+ *   params - the BlendParams with the RGB color to draw the glyph with.
  */
-#define _BLEND_SIMPLE_FUNC( dest, src, _0, _1, _2, r, g, b )     \
+#define _BLEND_SIMPLE_FUNC( dest, src, _0, _1, _2, params )      \
   do {                                                           \
     unsigned char pix_r, pix_g, pix_b;                           \
                                                                  \
@@ -180,9 +187,9 @@
     pix_g = _GET_GREEN( dest[0] );                               \
     pix_b = _GET_BLUE( dest[0] );                                \
                                                                  \
-    pix_r = _ALPHA_BLEND( pix_r, src[ _0 ], r );                 \
-    pix_g = _ALPHA_BLEND( pix_g, src[ _1 ], g );                 \
-    pix_b = _ALPHA_BLEND( pix_b, src[ _2 ], b );                 \
+    pix_r = _ALPHA_BLEND( pix_r, src[ _0 ], params->red );       \
+    pix_g = _ALPHA_BLEND( pix_g, src[ _1 ], params->green );     \
+    pix_b = _ALPHA_BLEND( pix_b, src[ _2 ], params->blue );      \
                                                                  \
     dest[0] = _PIXEL( pix_r, pix_g, pix_b );                     \
   } while( 0 )
@@ -201,31 +208,31 @@
  *   _0, _1, _2 - indices to access the source alpha map RGB values. For
  *                greyscale maps these should all be set to 0.
  *
- *   r, g, b - RGB color values to draw the glyph with. These should specify
- *             a color in linear space.
+ *   params - the BlendParams with the RGB color to draw the glyph with (in
+ *            linear space) and the gamma tables.
  */
-#define _BLEND_LINEAR_FUNC( dest, src, _0, _1, _2, r, g, b )      \
-  do {                                                            \
-    unsigned char pix_r, pix_g, pix_b;                            \
-    unsigned int lin_r, lin_g, lin_b;                             \
-                                                                  \
-    pix_r = _GET_RED( dest[0] );                                  \
-    pix_g = _GET_GREEN( dest[0] );                                \
-    pix_b = _GET_BLUE( dest[0] );                                 \
-                                                                  \
-    lin_r = globals.gamma_table[pix_r];                           \
-    lin_g = globals.gamma_table[pix_g];                           \
-    lin_b = globals.gamma_table[pix_b];                           \
-                                                                  \
-    lin_r = _ALPHA_BLEND( lin_r, src[ _0 ], r );                  \
-    lin_g = _ALPHA_BLEND( lin_g, src[ _1 ], g );                  \
-    lin_b = _ALPHA_BLEND( lin_b, src[ _2 ], b );                  \
-                                                                  \
-    pix_r = globals.gamma_inv_table[(unsigned short) lin_r];      \
-    pix_g = globals.gamma_inv_table[(unsigned short) lin_g];      \
-    pix_b = globals.gamma_inv_table[(unsigned short) lin_b];      \
-                                                                  \
-    dest[0] = _PIXEL( pix_r, pix_g, pix_b );                      \
+#define _BLEND_LINEAR_FUNC( dest, src, _0, _1, _2, params )                \
+  do {                                                                     \
+    unsigned char pix_r, pix_g, pix_b;                                     \
+    unsigned int lin_r, lin_g, lin_b;                                      \
+                                                                           \
+    pix_r = _GET_RED( dest[0] );                                           \
+    pix_g = _GET_GREEN( dest[0] );                                         \
+    pix_b = _GET_BLUE( dest[0] );                                          \
+                                                                           \
+    lin_r = params->gamma_table[pix_r];                                    \
+    lin_g = params->gamma_table[pix_g];                                    \
+    lin_b = params->gamma_table[pix_b];                                    \
+                                                                           \
+    lin_r = _ALPHA_BLEND( lin_r, src[ _0 ], params->red );                 \
+    lin_g = _ALPHA_BLEND( lin_g, src[ _1 ], params->green );               \
+    lin_b = _ALPHA_BLEND( lin_b, src[ _2 ], params->blue );                \
+                                                                           \
+    pix_r = params->gamma_inv_table[(unsigned short) lin_r];               \
+    pix_g = params->gamma_inv_table[(unsigned short) lin_g];               \
+    pix_b = params->gamma_inv_table[(unsigned short) lin_b];               \
+                                                                           \
+    dest[0] = _PIXEL( pix_r, pix_g, pix_b );                               \
   } while( 0 )
 
 
@@ -239,6 +246,305 @@
 #define _BLEND_SIMPLE _BLEND_SIMPLE_FUNC
 
 
+/*
+ * _BLEND_ROW_FUNC
+ *
+ * Define a plain C BlendRowFunc that calls the blending macro for each pixel.
+ *
+ * Params:
+ *   name - name of the function to define.
+ *
+ *   func - the blending macro to call per pixel.
+ *
+ *   src_pix_bytes - bytes per source pixel, 1 for greyscale or 3 for RGB.
+ *
+ *   _0, _1, _2 - indices of the source alpha map RGB values.
+ */
+#define _BLEND_ROW_FUNC( name, func, src_pix_bytes, _0, _1, _2 )             \
+  static void                                                                \
+  name( unsigned int         *dest,                                          \
+        const unsigned char  *src,                                           \
+        unsigned int          width,                                         \
+        const BlendParams    *params )                                       \
+  {                                                                          \
+    for( unsigned int x = 0; x < width; x++ )                                \
+    {                                                                        \
+      const unsigned char* spixel = src + x * src_pix_bytes;                 \
+      unsigned int* dpixel = dest + x;                                       \
+      func( dpixel, spixel, _0, _1, _2, params );                            \
+    }                                                                        \
+  }
+
+_BLEND_ROW_FUNC( _simple_row_gray, _BLEND_SIMPLE, 1, 0, 0, 0 )
+_BLEND_ROW_FUNC( _simple_row_lcd,  _BLEND_SIMPLE, 3, 0, 1, 2 )
+_BLEND_ROW_FUNC( _linear_row_gray, _BLEND_LINEAR, 1, 0, 0, 0 )
+_BLEND_ROW_FUNC( _linear_row_lcd,  _BLEND_LINEAR, 3, 0, 1, 2 )
+
+
+  const BlendKernels blend_kernels_scalar =
+  {
+    "C",
+    GAMMA_LINEAR_BITS_HIGH,
+    _simple_row_gray,
+    _simple_row_lcd,
+    _linear_row_gray,
+    _linear_row_lcd
+  };
+
+
+  static const BlendKernels *
+  _get_kernels()
+  {
+    /* Kernel set picked for this CPU, set on first use */
+    static gsize kernels = 0;
+
+    if( g_once_init_enter( &kernels ) )
+    {
+      const BlendKernels *picked = &blend_kernels_scalar;
+
+#ifdef GLYPH_BLENDING_X86_KERNELS
+      /* Checks cpuid (and that the OS saves the AVX registers) */
+      __builtin_cpu_init();
+
+      if( __builtin_cpu_supports( "avx2" ) )
+        picked = &blend_kernels_avx2;
+
+      else if( __builtin_cpu_supports( "sse2" ) )
+        picked = &blend_kernels_sse2;
+#endif
+
+      g_once_init_leave( &kernels, (gsize) picked );
+    }
+
+    return (const BlendKernels *) kernels;
+  }
+
+
+  static const BlendKernels *
+  _get_linear_kernels( const GammaTables *gamma_tables )
+  {
+    const BlendKernels *kernels = _get_kernels();
+
+    if( gamma_tables->linear_bits > kernels->linear_bits_max )
+      return &blend_kernels_scalar;
+
+    return kernels;
+  }
+
+
+  /* Name of the blending kernels used, for display. */
+  const char *
+  get_blend_kernels_name()
+  {
+    return _get_kernels()->name;
+  }
+
+
+/* -------------------------------------------------------------------------- *\
+ *
+ *                           == Coverage runs ==
+ *
+ * Most of a glyph's coverage map is either empty or fully covered. Rows are
+ * split into runs of empty, full and partial (edge) pixels so only the edges
+ * need blending, empty runs keep the background and full runs are filled with
+ * the glyph color.
+ *
+\* -------------------------------------------------------------------------- */
+
+
+  typedef enum CoverageRun_
+  {
+    _RUN_EMPTY,
+    _RUN_FULL,
+    _RUN_PARTIAL
+  } CoverageRun;
+
+
+  /* Pixels handled by each kind of run since startup. Blending can happen */
+  /* on several threads so each call counts locally and adds its totals.   */
+  static BlendStats _blend_stats;
+  G_LOCK_DEFINE_STATIC( _blend_stats );
+
+
+  static inline CoverageRun
+  _classify_pixel( const unsigned char *src, unsigned int src_pix_bytes )
+  {
+    if( src_pix_bytes == 1 )
+    {
+      if( src[0] == 0x00 )
+        return _RUN_EMPTY;
+      if( src[0] == 0xFF )
+        return _RUN_FULL;
+    }
+    else
+    {
+      if( ( src[0] | src[1] | src[2] ) == 0x00 )
+        return _RUN_EMPTY;
+      if( ( src[0] & src[1] & src[2] ) == 0xFF )
+        return _RUN_FULL;
+    }
+
+    return _RUN_PARTIAL;
+  }
+
+
+  /*
+   * Find the end of the run of pixels starting at x that are all of the same
+   * kind. The kind of run is returned through type.
+   */
+  static unsigned int
+  _find_run_end( const unsigned char  *src,
+                 unsigned int          x,
+                 unsigned int          width,
+                 unsigned int          src_pix_bytes,
+                 CoverageRun          *type )
+  {
+    *type = _classify_pixel( src + x * src_pix_bytes, src_pix_bytes );
+
+    for( x++; x < width; x++ )
+    {
+      if( _classify_pixel( src + x * src_pix_bytes, src_pix_bytes ) != *type )
+        break;
+    }
+
+    return x;
+  }
+
+
+  static void
+  _count_run( BlendStats *stats, CoverageRun type, unsigned int length )
+  {
+    switch( type )
+    {
+      case _RUN_EMPTY:
+        stats->empty_pixels += length;
+        break;
+
+      case _RUN_FULL:
+        stats->full_pixels += length;
+        break;
+
+      default:
+        stats->partial_pixels += length;
+        break;
+    }
+  }
+
+
+  static void
+  _add_blend_stats( const BlendStats *stats )
+  {
+    G_LOCK( _blend_stats );
+
+    _blend_stats.empty_pixels   += stats->empty_pixels;
+    _blend_stats.full_pixels    += stats->full_pixels;
+    _blend_stats.partial_pixels += stats->partial_pixels;
+
+    G_UNLOCK( _blend_stats );
+  }
+
+
+  void
+  get_blend_stats( BlendStats *stats )
+  {
+    G_LOCK( _blend_stats );
+    *stats = _blend_stats;
+    G_UNLOCK( _blend_stats );
+  }
+
+
+/*
+ * _blend_rows
+ *
+ * Convert the glyph coverage (alpha) map into a rasterized glyph image with
+ * specified color.
+ * 
+ * Params:
+ *   dest - the destination bitmap. Should have the same width and height
+ *          as the source bitmap (excluding any padding i.e width and pitch
+ *          aren't the same).
+ *
+ *   src - the coverage bitmap output by freetype. The bitmap should either
+ *         be a greyscale or RGB bitmap.
+ *
+ *   row_func - the blending function to call for runs of edge pixels.
+ *
+ *   params - color and gamma tables to pass to row_func. If using linear
+ *            blending, the color should be converted to linear values.
+ *
+ * The source FT_Bitmap is expected to have a pixel mode of either
+ * FT_PIXEL_MODE_GRAY (byte per pixel) or FT_PIXEL_MODE_LCD (3 bytes per pixel)
+ * while the destination cairo surface is expected to be an image surface with
+ * a format of CAIRO_FORMAT_RGB24 (4 bytes per pixel 0RGB in the platform's
+ * native endian order).
+ */
+  static void
+  _blend_rows( cairo_surface_t    *dest,
+               FT_Bitmap          *src,
+               BlendRowFunc        row_func,
+               const BlendParams  *params )
+  {
+    unsigned int width, height, pitch, stride, src_pix_bytes;
+    unsigned char *data;
+    unsigned int full_pixel = 0;
+    static const unsigned char full_coverage[3] = { 0xFF, 0xFF, 0xFF };
+    BlendStats stats = { 0, 0, 0 };
+
+    if( src->pixel_mode == FT_PIXEL_MODE_LCD )
+    {
+      width = src->width / 3;
+      src_pix_bytes = 3;
+    }
+    else
+    {
+      width = src->width;
+      src_pix_bytes = 1;
+    }
+
+    height = src->rows;
+    pitch = (unsigned int) abs( src->pitch );
+    stride = (unsigned int) cairo_image_surface_get_stride( dest );
+    data = cairo_image_surface_get_data( dest );
+
+    /* Fully covered pixels don't depend on the background. Get the value */
+    /* from the kernel so it matches what blending would have given.      */
+    row_func( &full_pixel, full_coverage, 1, params );
+
+    cairo_surface_flush( dest );
+
+    for( unsigned int y = 0; y < height; y++ )
+    {
+      unsigned char* srow = ( (unsigned char*) src->buffer ) + y * pitch;
+      unsigned int* drow = (unsigned int*) ( data + y * stride );
+      unsigned int x = 0;
+
+      while( x < width )
+      {
+        CoverageRun type;
+        unsigned int end = _find_run_end( srow, x, width, src_pix_bytes,
+                                          &type );
+
+        if( type == _RUN_FULL )
+        {
+          for( unsigned int i = x; i < end; i++ )
+            drow[i] = full_pixel;
+        }
+        else if( type == _RUN_PARTIAL )
+        {
+          row_func( drow + x, srow + x * src_pix_bytes, end - x, params );
+        }
+
+        _count_run( &stats, type, end - x );
+        x = end;
+      }
+    }
+
+    _add_blend_stats( &stats );
+
+    cairo_surface_mark_dirty( dest );
+  }
+
+
   static void
   _simple_blend( cairo_surface_t  *dest_bitmap,
                  FT_Bitmap        *src_bitmap,
@@ -246,24 +552,37 @@
                  unsigned char     green,
                  unsigned char     blue )
   {
-    _BLENDING_LOOP( dest_bitmap, src_bitmap, red, green, blue, _BLEND_SIMPLE );
+    const BlendKernels *kernels = _get_kernels();
+    BlendParams params = { red, green, blue, 0, 0 };
+
+    _blend_rows( dest_bitmap, src_bitmap,
+                 src_bitmap->pixel_mode == FT_PIXEL_MODE_LCD
+                     ? kernels->simple_lcd : kernels->simple_gray,
+                 &params );
   }
 
 
   static void
-  _linear_blend( cairo_surface_t  *dest_bitmap,
-                 FT_Bitmap        *src_bitmap,
-                 unsigned char     red,
-                 unsigned char     green,
-                 unsigned char     blue )
+  _linear_blend( cairo_surface_t    *dest_bitmap,
+                 FT_Bitmap          *src_bitmap,
+                 unsigned char       red,
+                 unsigned char       green,
+                 unsigned char       blue,
+                 const GammaTables  *gamma_tables )
   {
-    unsigned short c_r, c_g, c_b;
+    const BlendKernels *kernels = _get_linear_kernels( gamma_tables );
+    BlendParams params;
 
-    c_r = globals.gamma_table[red];
-    c_g = globals.gamma_table[green];
-    c_b = globals.gamma_table[blue];
+    params.red   = gamma_tables->to_linear[red];
+    params.green = gamma_tables->to_linear[green];
+    params.blue  = gamma_tables->to_linear[blue];
+    params.gamma_table = gamma_tables->to_linear;
+    params.gamma_inv_table = gamma_tables->from_linear;
 
-    _BLENDING_LOOP( dest_bitmap, src_bitmap, c_r, c_g, c_b, _BLEND_LINEAR );
+    _blend_rows( dest_bitmap, src_bitmap,
+                 src_bitmap->pixel_mode == FT_PIXEL_MODE_LCD
+                     ? kernels->linear_lcd : kernels->linear_gray,
+                 &params );
   }
 
 
@@ -280,15 +599,14 @@
 
 
   void
-  blend_glyph_to_surface( FT_Bitmap        *bitmap,
-                          cairo_surface_t  *surface,
-                          double           red,
-                          double           green,
-                          double           blue,
-                          int              blend_linear )
+  blend_glyph_to_surface( FT_Bitmap          *bitmap,
+                          cairo_surface_t    *surface,
+                          double              red,
+                          double              green,
+                          double              blue,
+                          const GammaTables  *linear )
   {
     unsigned char r, g, b;
-    int is_rgb = 0;
 
     r = (unsigned char)( red   * 255 );
     g = (unsigned char)( green * 255 );
@@ -301,11 +619,713 @@
     else if( cairo_surface_get_type(surface) != CAIRO_SURFACE_TYPE_IMAGE )
       panic("blend_glyph_to_surface: surface type is %d", bitmap->pixel_mode );
 
-    if( blend_linear )
-      _linear_blend( surface, bitmap, r, g, b );
+    if( linear )
+      _linear_blend( surface, bitmap, r, g, b, linear );
     else
       _simple_blend( surface, bitmap, r, g, b );
   }
 
 
+/* -------------------------------------------------------------------------- *\
+ *
+ *                    == Solid background glyph blending ==
+ *
+ * When the glyph is blended onto a single background color each output
+ * component only depends on its coverage value. The blend results for all 256
+ * coverage values are worked out once per color/gamma combination and the
+ * glyph surface is filled straight from the tables without reading it back.
+ *
+\* -------------------------------------------------------------------------- */
+
+
+/* Number of color/gamma combinations to keep tables for */
+#define _SOLID_TABLES_CACHED 4
+
+
+  typedef struct SolidBlendTablesRec_
+  {
+    gboolean       valid;
+
+    /* What the tables were made for */
+    double              fg[3];
+    double              bg[3];
+    const GammaTables  *linear;
+
+    /* Coverage to pixel component, already shifted into place */
+    unsigned int   red[256];
+    unsigned int   green[256];
+    unsigned int   blue[256];
+
+    /* Coverage to whole pixel for greyscale bitmaps */
+    unsigned int   gray[256];
+  } SolidBlendTables;
+
+
+  typedef struct SolidBlendTablesCacheRec_
+  {
+    SolidBlendTables   tables[_SOLID_TABLES_CACHED];
+
+    /* Slot to replace next */
+    int                next;
+  } SolidBlendTablesCache;
+
+
+  /* Each thread that blends keeps its own tables so none are shared */
+  static GPrivate _solid_tables_cache = G_PRIVATE_INIT( g_free );
+
+
+  /*
+   * Get the pixel cairo fills a RGB24 surface with for a color. Painting it
+   * for real makes sure the background matches what the general blending path
+   * blends over.
+   */
+  static unsigned int
+  _solid_color_pixel( const double color[3] )
+  {
+    unsigned int pixel;
+    cairo_surface_t *surface;
+    cairo_t *cr;
+
+    surface = cairo_image_surface_create( CAIRO_FORMAT_RGB24, 1, 1 );
+
+    cr = cairo_create( surface );
+    cairo_set_source_rgb( cr, color[0], color[1], color[2] );
+    cairo_paint( cr );
+    cairo_destroy( cr );
+
+    cairo_surface_flush( surface );
+    pixel = *(unsigned int *) cairo_image_surface_get_data( surface );
+
+    cairo_surface_destroy( surface );
+
+    return pixel & 0xFFFFFF;
+  }
+
+
+  static void
+  _build_solid_tables( SolidBlendTables   *tables,
+                       const double        fg[3],
+                       const double        bg[3],
+                       const GammaTables  *linear )
+  {
+    BlendParams params;
+    unsigned int bg_pixel = _solid_color_pixel( bg );
+    unsigned char coverage[256];
+    unsigned int pixels[256];
+
+    params.red   = (unsigned char)( fg[0] * 255 );
+    params.green = (unsigned char)( fg[1] * 255 );
+    params.blue  = (unsigned char)( fg[2] * 255 );
+    params.gamma_table = 0;
+    params.gamma_inv_table = 0;
+
+    if( linear )
+    {
+      params.red   = linear->to_linear[params.red];
+      params.green = linear->to_linear[params.green];
+      params.blue  = linear->to_linear[params.blue];
+      params.gamma_table = linear->to_linear;
+      params.gamma_inv_table = linear->from_linear;
+    }
+
+    /*
+     * Run every coverage value through the normal row kernel so the tables
+     * can't disagree with the general path.
+     */
+    for( int i = 0; i < 256; i++ )
+    {
+      coverage[i] = (unsigned char) i;
+      pixels[i] = bg_pixel;
+    }
+
+    if( linear )
+      blend_kernels_scalar.linear_gray( pixels, coverage, 256, &params );
+    else
+      blend_kernels_scalar.simple_gray( pixels, coverage, 256, &params );
+
+    for( int i = 0; i < 256; i++ )
+    {
+      tables->gray[i]  = pixels[i];
+      tables->red[i]   = pixels[i] & 0xFF0000;
+      tables->green[i] = pixels[i] & 0x00FF00;
+      tables->blue[i]  = pixels[i] & 0x0000FF;
+    }
+
+    /* Empty runs are left as the background by the general path rather */
+    /* than blended, keep that the same here.                           */
+    tables->gray[0] = bg_pixel;
+
+    for( int c = 0; c < 3; c++ )
+    {
+      tables->fg[c] = fg[c];
+      tables->bg[c] = bg[c];
+    }
+
+    tables->linear = linear;
+    tables->valid = TRUE;
+  }
+
+
+  static const SolidBlendTables *
+  _get_solid_tables( const double        fg[3],
+                     const double        bg[3],
+                     const GammaTables  *linear )
+  {
+    SolidBlendTablesCache *cache = g_private_get( &_solid_tables_cache );
+    SolidBlendTables *tables;
+
+    if( !cache )
+    {
+      cache = g_new0( SolidBlendTablesCache, 1 );
+      g_private_set( &_solid_tables_cache, cache );
+    }
+
+    for( int i = 0; i < _SOLID_TABLES_CACHED; i++ )
+    {
+      tables = &cache->tables[i];
+
+      if( tables->valid           &&
+          tables->linear == linear &&
+          tables->fg[0] == fg[0] && tables->bg[0] == bg[0] &&
+          tables->fg[1] == fg[1] && tables->bg[1] == bg[1] &&
+          tables->fg[2] == fg[2] && tables->bg[2] == bg[2] )
+        return tables;
+    }
+
+    tables = &cache->tables[cache->next];
+    cache->next = ( cache->next + 1 ) % _SOLID_TABLES_CACHED;
+
+    _build_solid_tables( tables, fg, bg, linear );
+
+    return tables;
+  }
+
+
+  /*
+   * Same result as filling the surface with the background color and then
+   * calling blend_glyph_to_surface() but without touching the surface twice.
+   * Every pixel of the surface is written.
+   */
+  void
+  blend_glyph_to_solid_surface( FT_Bitmap          *bitmap,
+                                cairo_surface_t    *surface,
+                                const double        fg[3],
+                                const double        bg[3],
+                                const GammaTables  *linear )
+  {
+    const SolidBlendTables *tables;
+    unsigned int width, height, pitch, stride, src_pix_bytes;
+    unsigned char *data;
+    BlendStats stats = { 0, 0, 0 };
+
+    if( bitmap->pixel_mode != FT_PIXEL_MODE_GRAY &&
+        bitmap->pixel_mode != FT_PIXEL_MODE_LCD )
+      panic( "blend_glyph_to_solid_surface: pixel mode is %d",
+             bitmap->pixel_mode );
+
+    tables = _get_solid_tables( fg, bg, linear );
+
+    src_pix_bytes = ( bitmap->pixel_mode == FT_PIXEL_MODE_LCD ) ? 3 : 1;
+    width = cairo_image_surface_get_width( surface );
+    height = cairo_image_surface_get_height( surface );
+    pitch = (unsigned int) abs( bitmap->pitch );
+    stride = (unsigned int) cairo_image_surface_get_stride( surface );
+    data = cairo_image_surface_get_data( surface );
+
+    cairo_surface_flush( surface );
+
+    for( unsigned int y = 0; y < height; y++ )
+    {
+      const unsigned char *srow = bitmap->buffer + y * pitch;
+      unsigned int *drow = (unsigned int *)( data + y * stride );
+      unsigned int x = 0;
+
+      while( x < width )
+      {
+        CoverageRun type;
+        unsigned int end = _find_run_end( srow, x, width, src_pix_bytes,
+                                          &type );
+
+        if( type == _RUN_EMPTY || type == _RUN_FULL )
+        {
+          unsigned int pixel = tables->gray[ type == _RUN_FULL ? 0xFF : 0 ];
+
+          for( unsigned int i = x; i < end; i++ )
+            drow[i] = pixel;
+        }
+        else if( src_pix_bytes == 3 )
+        {
+          for( unsigned int i = x; i < end; i++ )
+            drow[i] = tables->red[ srow[i * 3 + 0] ] |
+                      tables->green[ srow[i * 3 + 1] ] |
+                      tables->blue[ srow[i * 3 + 2] ];
+        }
+        else
+        {
+          for( unsigned int i = x; i < end; i++ )
+            drow[i] = tables->gray[ srow[i] ];
+        }
+
+        _count_run( &stats, type, end - x );
+        x = end;
+      }
+    }
+
+    _add_blend_stats( &stats );
+
+    cairo_surface_mark_dirty( surface );
+  }
+
+
+/* -------------------------------------------------------------------------- *\
+ *
+ *                      == Direct outline rendering ==
+ *
+ * Greyscale glyphs can be rendered with FT_Outline_Render in direct mode so
+ * the rasterizer hands over coverage spans instead of filling a bitmap. The
+ * spans are blended straight into the glyph surface (already filled with the
+ * background) which skips the glyph slot bitmap and a pass over it.
+ *
+\* -------------------------------------------------------------------------- */
+
+
+  typedef struct SpanTargetRec_
+  {
+    unsigned char           *data;
+    unsigned int             stride;
+    unsigned int             height;
+    const SolidBlendTables  *tables;
+
+    /* Pixels written by spans so far */
+    unsigned long long       covered;
+    BlendStats               stats;
+  } SpanTarget;
+
+
+  /*
+   * Get the outline's control box rounded out to whole pixels (as the smooth
+   * renderer does) along with its size and position in pixels.
+   */
+  static void
+  _get_outline_pixel_box( FT_Outline    *outline,
+                          FT_BBox       *cbox,
+                          unsigned int  *width,
+                          unsigned int  *height,
+                          FT_Int        *bitmap_left,
+                          FT_Int        *bitmap_top )
+  {
+    FT_Outline_Get_CBox( outline, cbox );
+
+    cbox->xMin = cbox->xMin & -64;
+    cbox->yMin = cbox->yMin & -64;
+    cbox->xMax = ( cbox->xMax + 63 ) & -64;
+    cbox->yMax = ( cbox->yMax + 63 ) & -64;
+
+    *width  = (unsigned int)( ( cbox->xMax - cbox->xMin ) >> 6 );
+    *height = (unsigned int)( ( cbox->yMax - cbox->yMin ) >> 6 );
+
+    *bitmap_left = (FT_Int)( cbox->xMin >> 6 );
+    *bitmap_top  = (FT_Int)( cbox->yMax >> 6 );
+  }
+
+
+  /* FT_SpanFunc, y counts up from the bottom of the surface */
+  static void
+  _blend_spans( int            y,
+                int            count,
+                const FT_Span *spans,
+                void          *user )
+  {
+    SpanTarget *target = user;
+    unsigned int *drow;
+
+    drow = (unsigned int *)( target->data +
+                             ( target->height - 1 - y ) * target->stride );
+
+    for( int i = 0; i < count; i++ )
+    {
+      unsigned int pixel = target->tables->gray[ spans[i].coverage ];
+
+      for( int x = spans[i].x; x < spans[i].x + spans[i].len; x++ )
+        drow[x] = pixel;
+
+      _count_run( &target->stats,
+                  spans[i].coverage == 0xFF ? _RUN_FULL : _RUN_PARTIAL,
+                  spans[i].len );
+      target->covered += spans[i].len;
+    }
+  }
+
+
+  /*
+   * Render an outline straight into a new CAIRO_FORMAT_RGB24 surface filled
+   * with the background color. The surface covers the outline's control box
+   * rounded out to whole pixels, its position relative to the glyph origin is
+   * returned through bitmap_left and bitmap_top in the same way as the
+   * glyph slot's.
+   *
+   * Sets surface to the new surface, or returns the Freetype error and sets
+   * it to NULL if the outline couldn't be rendered. The outline is left where
+   * it was either way.
+   */
+  FT_Error
+  render_outline_to_solid_surface( FT_Library          library,
+                                   FT_Outline         *outline,
+                                   const double        fg[3],
+                                   const double        bg[3],
+                                   const GammaTables  *linear,
+                                   FT_Int             *bitmap_left,
+                                   FT_Int             *bitmap_top,
+                                   cairo_surface_t   **surface )
+  {
+    const SolidBlendTables *tables;
+    FT_Raster_Params params;
+    SpanTarget target;
+    FT_BBox cbox;
+    FT_Error error;
+    unsigned int width, height;
+
+    _get_outline_pixel_box( outline, &cbox, &width, &height,
+                            bitmap_left, bitmap_top );
+
+    tables = _get_solid_tables( fg, bg, linear );
+    *surface = cairo_image_surface_create( CAIRO_FORMAT_RGB24, width, height );
+
+    target.data = cairo_image_surface_get_data( *surface );
+    target.stride = (unsigned int) cairo_image_surface_get_stride( *surface );
+    target.height = height;
+    target.tables = tables;
+    target.covered = 0;
+    memset( &target.stats, 0, sizeof( target.stats ) );
+
+    cairo_surface_flush( *surface );
+
+    for( unsigned int y = 0; y < height; y++ )
+    {
+      unsigned int *drow = (unsigned int *)( target.data + y * target.stride );
+
+      for( unsigned int x = 0; x < width; x++ )
+        drow[x] = tables->gray[0];
+    }
+
+    if( width > 0 && height > 0 )
+    {
+      memset( &params, 0, sizeof( params ) );
+
+      params.flags = FT_RASTER_FLAG_AA     |
+                     FT_RASTER_FLAG_DIRECT |
+                     FT_RASTER_FLAG_CLIP;
+      params.gray_spans = _blend_spans;
+      params.user = &target;
+      params.clip_box.xMin = 0;
+      params.clip_box.yMin = 0;
+      params.clip_box.xMax = width;
+      params.clip_box.yMax = height;
+
+      /* Move the outline so the bottom left of the surface is at 0, 0 */
+      FT_Outline_Translate( outline, -cbox.xMin, -cbox.yMin );
+
+      error = FT_Outline_Render( library, outline, &params );
+
+      FT_Outline_Translate( outline, cbox.xMin, cbox.yMin );
+
+      if( error )
+      {
+        cairo_surface_destroy( *surface );
+        *surface = NULL;
+        return error;
+      }
+    }
+
+    /* Whatever the spans didn't touch was left as the background */
+    _count_run( &target.stats, _RUN_EMPTY,
+                (unsigned int)( (unsigned long long) width * height -
+                                target.covered ) );
+    _add_blend_stats( &target.stats );
+
+    cairo_surface_mark_dirty( *surface );
+
+    return FT_Err_Ok;
+  }
+
+
+  /*
+   * Render an outline's greyscale coverage into a new CAIRO_FORMAT_A8
+   * surface. Freetype writes straight into the surface's memory so there's no
+   * copy out of a glyph slot bitmap. The glyph color is applied when the
+   * surface is used as a mask at draw time.
+   *
+   * Sets surface to the new surface, or returns the Freetype error and sets
+   * it to NULL if the outline couldn't be rendered.
+   */
+  FT_Error
+  render_outline_to_coverage_surface( FT_Library          library,
+                                      FT_Outline         *outline,
+                                      FT_Int             *bitmap_left,
+                                      FT_Int             *bitmap_top,
+                                      cairo_surface_t   **surface )
+  {
+    FT_Bitmap bitmap;
+    FT_BBox cbox;
+    FT_Error error;
+    unsigned int width, height;
+
+    _get_outline_pixel_box( outline, &cbox, &width, &height,
+                            bitmap_left, bitmap_top );
+
+    /* Image surfaces start out cleared which is what the rasterizer needs */
+    *surface = cairo_image_surface_create( CAIRO_FORMAT_A8, width, height );
+
+    if( width > 0 && height > 0 )
+    {
+      cairo_surface_flush( *surface );
+
+      memset( &bitmap, 0, sizeof( bitmap ) );
+      bitmap.rows       = height;
+      bitmap.width      = width;
+      bitmap.pitch      = cairo_image_surface_get_stride( *surface );
+      bitmap.buffer     = cairo_image_surface_get_data( *surface );
+      bitmap.num_grays  = 256;
+      bitmap.pixel_mode = FT_PIXEL_MODE_GRAY;
+
+      FT_Outline_Translate( outline, -cbox.xMin, -cbox.yMin );
+
+      error = FT_Outline_Get_Bitmap( library, outline, &bitmap );
+
+      FT_Outline_Translate( outline, cbox.xMin, cbox.yMin );
+
+      if( error )
+      {
+        cairo_surface_destroy( *surface );
+        *surface = NULL;
+        return error;
+      }
+
+      cairo_surface_mark_dirty( *surface );
+    }
+
+    return FT_Err_Ok;
+  }
+
+
+/* -------------------------------------------------------------------------- *\
+ *
+ *                       == Subpixel mask expansion ==
+ *
+ * Each pixel of the glyph surface is turned into three grey pixels, one for
+ * each of the red, green and blue components.
+ *
+\* -------------------------------------------------------------------------- */
+
+
+  static void
+  _expand_subpixel_row_scalar( unsigned int        *dst,
+                               const unsigned int  *src,
+                               int                  width )
+  {
+    for( int px = 0; px < width; px++ )
+    {
+      unsigned int r = src[px] >> 16 & 0xFF;
+      unsigned int g = src[px] >>  8 & 0xFF;
+      unsigned int b = src[px] >>  0 & 0xFF;
+
+      dst[px * 3 + 0] = r << 16 | r << 8 | r;
+      dst[px * 3 + 1] = g << 16 | g << 8 | g;
+      dst[px * 3 + 2] = b << 16 | b << 8 | b;
+    }
+  }
+
+
+#ifdef __SSE2__
+
+  /* Repeat the low byte of each 32 bit lane into the lower three bytes. */
+  static inline __m128i
+  _grey_from_low_byte( __m128i v )
+  {
+    v = _mm_and_si128( v, _mm_set1_epi32( 0xFF ) );
+    v = _mm_or_si128( v, _mm_slli_epi32( v, 8 ) );
+    return _mm_or_si128( v, _mm_slli_epi32( v, 8 ) );
+  }
+
+
+  /*
+   * Four source pixels at a time. The red, green and blue greys are built in
+   * separate registers then interleaved into three output registers:
+   *
+   *   [r0 g0 b0 r1] [g1 b1 r2 g2] [b2 r3 g3 b3]
+   */
+  static void
+  _expand_subpixel_row_sse2( unsigned int        *dst,
+                             const unsigned int  *src,
+                             int                  width )
+  {
+    int px = 0;
+
+    for( ; px + 4 <= width; px += 4 )
+    {
+      __m128i pixels = _mm_loadu_si128( (const __m128i *)( src + px ) );
+
+      __m128 r = _mm_castsi128_ps(
+                     _grey_from_low_byte( _mm_srli_epi32( pixels, 16 ) ) );
+      __m128 g = _mm_castsi128_ps(
+                     _grey_from_low_byte( _mm_srli_epi32( pixels, 8 ) ) );
+      __m128 b = _mm_castsi128_ps( _grey_from_low_byte( pixels ) );
+
+      __m128 rg_lo = _mm_unpacklo_ps( r, g ); /* r0 g0 r1 g1 */
+      __m128 rg_hi = _mm_unpackhi_ps( r, g ); /* r2 g2 r3 g3 */
+
+      __m128 b0r1 = _mm_shuffle_ps( b, rg_lo, _MM_SHUFFLE( 2, 2, 0, 0 ) );
+      __m128 g1b1 = _mm_shuffle_ps( rg_lo, b, _MM_SHUFFLE( 1, 1, 3, 3 ) );
+      __m128 b2r3 = _mm_shuffle_ps( b, rg_hi, _MM_SHUFFLE( 2, 2, 2, 2 ) );
+      __m128 g3b3 = _mm_shuffle_ps( rg_hi, b, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+
+      __m128 out0 = _mm_shuffle_ps( rg_lo, b0r1, _MM_SHUFFLE( 2, 0, 1, 0 ) );
+      __m128 out1 = _mm_shuffle_ps( g1b1, rg_hi, _MM_SHUFFLE( 1, 0, 2, 0 ) );
+      __m128 out2 = _mm_shuffle_ps( b2r3, g3b3, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+
+      _mm_storeu_si128( (__m128i *)( dst + px * 3 + 0 ),
+                        _mm_castps_si128( out0 ) );
+      _mm_storeu_si128( (__m128i *)( dst + px * 3 + 4 ),
+                        _mm_castps_si128( out1 ) );
+      _mm_storeu_si128( (__m128i *)( dst + px * 3 + 8 ),
+                        _mm_castps_si128( out2 ) );
+    }
+
+    _expand_subpixel_row_scalar( dst + px * 3, src + px, width - px );
+  }
+
+#define _EXPAND_SUBPIXEL_ROW _expand_subpixel_row_sse2
+
+#else
+
+#define _EXPAND_SUBPIXEL_ROW _expand_subpixel_row_scalar
+
+#endif /* __SSE2__ */
+
+
+  /*
+   * Create a surface three times the width of the glyph surface with the
+   * intensity of each subpixel drawn as a grey pixel. The caller owns the
+   * returned surface.
+   */
+  cairo_surface_t *
+  create_subpixel_mask_surface( cairo_surface_t *glyph_surface )
+  {
+    cairo_surface_t *surface;
+
+    int src_width = cairo_image_surface_get_width( glyph_surface );
+    int src_height = cairo_image_surface_get_height( glyph_surface );
+    int src_stride = cairo_image_surface_get_stride( glyph_surface );
+
+    unsigned char *src_data = cairo_image_surface_get_data( glyph_surface );
+
+    surface = cairo_image_surface_create( CAIRO_FORMAT_RGB24, src_width * 3,
+                                                              src_height );
+
+    unsigned char *dst_data = cairo_image_surface_get_data( surface );
+
+    int dst_stride = cairo_image_surface_get_stride( surface );
+
+    /* Probably unnecessary but just to be safe */
+    cairo_surface_flush( surface );
+
+    for( int row = 0; row < src_height; row++ )
+    {
+      /* Stride is the row size in BYTES */
+      _EXPAND_SUBPIXEL_ROW(
+          (unsigned int *)( dst_data + row * dst_stride ),
+          (const unsigned int *)( src_data + row * src_stride ),
+          src_width );
+    }
+
+    cairo_surface_mark_dirty( surface );
+
+    return surface;
+  }
+
+
+  /*
+   * Scale an image surface up by pixel replication (nearest neighbour) to
+   * dst_width and y_scale times its height. Each source column covers
+   * however many destination columns have their centre inside it, so the
+   * width doesn't have to be a whole multiple. Only the first copy of each
+   * row is built, the rest are copied from it. Handles the 32 bit formats
+   * and A8. The caller owns the returned surface.
+   */
+  cairo_surface_t *
+  create_magnified_surface( cairo_surface_t *src_surface,
+                            int              dst_width,
+                            int              y_scale )
+  {
+    cairo_surface_t *surface;
+    cairo_format_t format = cairo_image_surface_get_format( src_surface );
+
+    int src_width = cairo_image_surface_get_width( src_surface );
+    int src_height = cairo_image_surface_get_height( src_surface );
+    int src_stride = cairo_image_surface_get_stride( src_surface );
+
+    unsigned char *src_data = cairo_image_surface_get_data( src_surface );
+
+    if( format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24 &&
+        format != CAIRO_FORMAT_A8 )
+      panic( "create_magnified_surface: unsupported format %d", format );
+
+    surface = cairo_image_surface_create( format, dst_width,
+                                          src_height * y_scale );
+
+    unsigned char *dst_data = cairo_image_surface_get_data( surface );
+
+    int dst_stride = cairo_image_surface_get_stride( surface );
+
+    /* Number of destination columns each source column is repeated for */
+    int *runs = g_new0( int, src_width > 0 ? src_width : 1 );
+
+    for( int x = 0; x < dst_width; x++ )
+      runs[ ( 2 * (gint64) x + 1 ) * src_width / ( 2 * (gint64) dst_width ) ]++;
+
+    cairo_surface_flush( src_surface );
+    cairo_surface_flush( surface );
+
+    for( int row = 0; row < src_height; row++ )
+    {
+      unsigned char *src_row = src_data + row * src_stride;
+      unsigned char *dst_row = dst_data + row * y_scale * dst_stride;
+
+      if( format == CAIRO_FORMAT_A8 )
+      {
+        unsigned char *dst = dst_row;
+
+        for( int x = 0; x < src_width; x++ )
+        {
+          memset( dst, src_row[x], runs[x] );
+          dst += runs[x];
+        }
+      }
+      else
+      {
+        const unsigned int *src = (const unsigned int *) src_row;
+        unsigned int *dst = (unsigned int *) dst_row;
+
+        for( int x = 0; x < src_width; x++ )
+        {
+          unsigned int pixel = src[x];
+
+          for( int i = 0; i < runs[x]; i++ )
+            *dst++ = pixel;
+        }
+      }
+
+      /* The rest of the rows are the same */
+      for( int i = 1; i < y_scale; i++ )
+        memcpy( dst_row + i * dst_stride, dst_row, dst_stride );
+    }
+
+    g_free( runs );
+
+    cairo_surface_mark_dirty( surface );
+
+    return surface;
+  }
+
+
 /* END */
@@ -24,20 +24,99 @@
 /* The value that 0xFF will map to in linear space. */
 #define GAMMA_LINEAR_MAX ( GAMMA_LINEAR_NUM_VALUES - 1 )
 
+/* Bits used for linear values when more precision is wanted */
+#define GAMMA_LINEAR_BITS_HIGH 16
+
+
+  /*
+   * Conversion tables for one gamma value, from get_gamma_tables(). They
+   * never change once made so can be shared freely.
+   */
+  typedef struct GammaTablesRec_
+  {
+    double           gamma;
+
+    /* Precision of the linear values and the value 0xFF maps to */
+    unsigned int     linear_bits;
+    unsigned int     linear_max;
+
+    /* Gamma encoded (normal RGB) to linear */
+    unsigned short   to_linear[256];
+
+    /* Linear back to gamma encoded, linear_max + 1 entries */
+    unsigned char   *from_linear;
+  } GammaTables;
 
-  void
-  calculate_gamma_tables();
+
+  /*
+   * Number of glyph pixels blending had to do no work for (empty coverage),
+   * could fill with the glyph color (full coverage) or had to blend (partial
+   * coverage at the glyph's edges).
+   */
+  typedef struct BlendStatsRec_
+  {
+    unsigned long long  empty_pixels;
+    unsigned long long  full_pixels;
+    unsigned long long  partial_pixels;
+  } BlendStats;
+
+
+  const GammaTables *
+  get_gamma_tables( double gamma, unsigned int linear_bits );
 
   cairo_surface_t *
   create_surface_for_ft_bitmap_dimensions( FT_Bitmap *bitmap );
 
+  /*
+   * The blending functions below take the gamma tables to do linear blending
+   * with or NULL to blend without gamma correction.
+   */
+
   void
-  blend_glyph_to_surface( FT_Bitmap        *bitmap,
-                          cairo_surface_t  *surface,
-                          double           red,
-                          double           green,
-                          double           blue,
-                          int              blend_linear );
+  blend_glyph_to_surface( FT_Bitmap          *bitmap,
+                          cairo_surface_t    *surface,
+                          double              red,
+                          double              green,
+                          double              blue,
+                          const GammaTables  *linear );
+
+  void
+  blend_glyph_to_solid_surface( FT_Bitmap          *bitmap,
+                                cairo_surface_t    *surface,
+                                const double        fg[3],
+                                const double        bg[3],
+                                const GammaTables  *linear );
+
+  FT_Error
+  render_outline_to_solid_surface( FT_Library          library,
+                                   FT_Outline         *outline,
+                                   const double        fg[3],
+                                   const double        bg[3],
+                                   const GammaTables  *linear,
+                                   FT_Int             *bitmap_left,
+                                   FT_Int             *bitmap_top,
+                                   cairo_surface_t   **surface );
+
+  FT_Error
+  render_outline_to_coverage_surface( FT_Library          library,
+                                      FT_Outline         *outline,
+                                      FT_Int             *bitmap_left,
+                                      FT_Int             *bitmap_top,
+                                      cairo_surface_t   **surface );
+
+  const char *
+  get_blend_kernels_name();
+
+  void
+  get_blend_stats( BlendStats *stats );
+
+  cairo_surface_t *
+  create_subpixel_mask_surface( cairo_surface_t *glyph_surface );
+
+  cairo_surface_t *
+  create_magnified_surface( cairo_surface_t *src_surface,
+                            int              dst_width,
+                            int              y_scale );
 
 
 #endif /* GLYPH_BLENDING_H_ */
@@ -0,0 +1,77 @@
+#ifndef GLYPH_BLENDING_KERNELS_H_
+#define GLYPH_BLENDING_KERNELS_H_
+
+/*
+ * Per row glyph blending kernels
+ *
+ * The blending in glyphblending.c is done a row at a time by one of these
+ * functions. There's a plain C set that works everywhere and SIMD sets that
+ * are picked at runtime when the CPU supports them. All sets must produce
+ * exactly the same output as the plain C version.
+ */
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define GLYPH_BLENDING_X86_KERNELS
+#endif
+
+
+  typedef struct BlendParamsRec_
+  {
+    /* Color to draw the glyph with. Linear values when blending linearly */
+    unsigned short        red;
+    unsigned short        green;
+    unsigned short        blue;
+
+    /* Only used for linear blending */
+    const unsigned short *gamma_table;
+    const unsigned char  *gamma_inv_table;
+  } BlendParams;
+
+
+  /*
+   * Blend a row of coverage values onto a row of CAIRO_FORMAT_RGB24 pixels.
+   *
+   *   dest - the destination pixels (0RGB in native endian order).
+   *
+   *   src - the coverage values, one byte per pixel for FT_PIXEL_MODE_GRAY or
+   *         three (R, G, B) for FT_PIXEL_MODE_LCD.
+   *
+   *   width - number of destination pixels.
+   */
+  typedef void
+  (*BlendRowFunc)( unsigned int         *dest,
+                   const unsigned char  *src,
+                   unsigned int          width,
+                   const BlendParams    *params );
+
+
+  typedef struct BlendKernelsRec_
+  {
+    const char    *name;
+
+    /* Most bits of precision the linear kernels can take in the gamma */
+    /* tables, the plain C kernels are used for anything more          */
+    unsigned int   linear_bits_max;
+
+    BlendRowFunc   simple_gray;
+    BlendRowFunc   simple_lcd;
+    BlendRowFunc   linear_gray;
+    BlendRowFunc   linear_lcd;
+  } BlendKernels;
+
+
+  /* Plain C kernels from glyphblending.c, also used for row tails. */
+  extern const BlendKernels blend_kernels_scalar;
+
+#ifdef GLYPH_BLENDING_X86_KERNELS
+
+  /* From glyphblending_x86.c */
+  extern const BlendKernels blend_kernels_sse2;
+  extern const BlendKernels blend_kernels_avx2;
+
+#endif
+
+
+#endif /* GLYPH_BLENDING_KERNELS_H_ */
+
+/* END */
\ No newline at end of file
@@ -0,0 +1,507 @@
+#include "glyphblending.h"
+#include "glyphblending_kernels.h"
+
+#ifdef GLYPH_BLENDING_X86_KERNELS
+
+#include <immintrin.h>
+#include <string.h>
+
+/*
+ * SSE2 and AVX2 versions of the glyph blending kernels.
+ *
+ * The functions are compiled with target attributes so the rest of the program
+ * doesn't need built for a newer CPU than the baseline. glyphblending.c only
+ * calls them after checking the CPU supports the instructions.
+ *
+ * The results have to match the plain C kernels exactly:
+ *
+ *   - Simple blending works in 16 bit lanes. fg * a + bg * ( 255 - a ) is at
+ *     most 255 * 255 so it fits and ( x + 1 + ( x >> 8 ) ) >> 8 is the same
+ *     as x / 255 over that range.
+ *
+ *   - Linear blending needs 32 bit lanes as the linear values go up to
+ *     GAMMA_LINEAR_MAX. The blend is done with a single multiply-add of the
+ *     ( fg, bg ) and ( a, 255 - a ) 16 bit pairs and the divide by 255 with a
+ *     single precision divide. The sum is below 2^21 so it converts exactly
+ *     and the rounded quotient can't reach the next integer, so truncating
+ *     gives the same result as integer division. The linear values are
+ *     worked on as signed 16 bit numbers so only the default precision
+ *     (GAMMA_LINEAR_BITS) is supported.
+ *
+ * Each kernel does as many whole vectors as it can and passes what's left of
+ * the row to the plain C kernel.
+ */
+
+#define _SSE2 __attribute__(( target( "sse2" ) ))
+#define _AVX2 __attribute__(( target( "avx2" ) ))
+
+
+/* -------------------------------------------------------------------------- *\
+ *
+ *                              == SSE2 ==
+ *
+\* -------------------------------------------------------------------------- */
+
+  /*
+   * Coverage for 4 pixels arranged like the destination pixels, the blue,
+   * green and red coverage in the low three bytes and 0 in the top byte.
+   */
+  static inline _SSE2 __m128i
+  _sse2_coverage_gray( const unsigned char *src )
+  {
+    int alpha;
+    __m128i cov;
+
+    memcpy( &alpha, src, 4 );
+
+    cov = _mm_cvtsi32_si128( alpha );
+    cov = _mm_unpacklo_epi8( cov, cov );
+    cov = _mm_unpacklo_epi16( cov, cov );
+
+    return _mm_and_si128( cov, _mm_set1_epi32( 0x00FFFFFF ) );
+  }
+
+
+  static inline _SSE2 __m128i
+  _sse2_coverage_lcd( const unsigned char *src )
+  {
+    /* No byte shuffle in SSE2, it's quicker to build the words directly */
+    return _mm_set_epi32( src[ 9] << 16 | src[10] << 8 | src[11],
+                          src[ 6] << 16 | src[ 7] << 8 | src[ 8],
+                          src[ 3] << 16 | src[ 4] << 8 | src[ 5],
+                          src[ 0] << 16 | src[ 1] << 8 | src[ 2] );
+  }
+
+
+  /* Blend 2 pixels worth of 16 bit components. */
+  static inline _SSE2 __m128i
+  _sse2_simple_blend_epi16( __m128i bg, __m128i alpha, __m128i fg )
+  {
+    __m128i x;
+
+    x = _mm_add_epi16(
+            _mm_mullo_epi16( fg, alpha ),
+            _mm_mullo_epi16( bg, _mm_sub_epi16( _mm_set1_epi16( 255 ),
+                                                alpha ) ) );
+
+    x = _mm_add_epi16( x, _mm_add_epi16( _mm_set1_epi16( 1 ),
+                                         _mm_srli_epi16( x, 8 ) ) );
+
+    return _mm_srli_epi16( x, 8 );
+  }
+
+
+  static inline _SSE2 void
+  _sse2_simple_row( unsigned int         *dest,
+                    const unsigned char  *src,
+                    unsigned int          width,
+                    const BlendParams    *params,
+                    int                   is_lcd )
+  {
+    unsigned int x = 0;
+    unsigned int src_pix_bytes = is_lcd ? 3 : 1;
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i fg = _mm_set_epi16( 0, params->red, params->green, params->blue,
+                                0, params->red, params->green, params->blue );
+
+    for( ; x + 4 <= width; x += 4 )
+    {
+      __m128i dst, cov, lo, hi;
+
+      dst = _mm_loadu_si128( (const __m128i *)( dest + x ) );
+      cov = is_lcd ? _sse2_coverage_lcd( src + x * src_pix_bytes )
+                   : _sse2_coverage_gray( src + x * src_pix_bytes );
+
+      lo = _sse2_simple_blend_epi16( _mm_unpacklo_epi8( dst, zero ),
+                                     _mm_unpacklo_epi8( cov, zero ), fg );
+      hi = _sse2_simple_blend_epi16( _mm_unpackhi_epi8( dst, zero ),
+                                     _mm_unpackhi_epi8( cov, zero ), fg );
+
+      dst = _mm_and_si128( _mm_packus_epi16( lo, hi ),
+                           _mm_set1_epi32( 0x00FFFFFF ) );
+
+      _mm_storeu_si128( (__m128i *)( dest + x ), dst );
+    }
+
+    if( is_lcd )
+      blend_kernels_scalar.simple_lcd( dest + x, src + x * 3, width - x,
+                                       params );
+    else
+      blend_kernels_scalar.simple_gray( dest + x, src + x, width - x,
+                                        params );
+  }
+
+
+  /* 32 bit lanes of ( fg * a + bg * ( 255 - a ) ) / 255 */
+  static inline _SSE2 __m128i
+  _sse2_linear_blend_epi32( __m128i bg, __m128i alpha, __m128i fg )
+  {
+    __m128i pair_color, pair_alpha, x;
+
+    pair_color = _mm_or_si128( fg, _mm_slli_epi32( bg, 16 ) );
+    pair_alpha = _mm_or_si128( alpha,
+                               _mm_slli_epi32(
+                                   _mm_sub_epi32( _mm_set1_epi32( 255 ),
+                                                  alpha ), 16 ) );
+
+    x = _mm_madd_epi16( pair_color, pair_alpha );
+
+    return _mm_cvttps_epi32( _mm_div_ps( _mm_cvtepi32_ps( x ),
+                                         _mm_set1_ps( 255.0f ) ) );
+  }
+
+
+  static inline _SSE2 void
+  _sse2_linear_row( unsigned int         *dest,
+                    const unsigned char  *src,
+                    unsigned int          width,
+                    const BlendParams    *params,
+                    int                   is_lcd )
+  {
+    unsigned int x = 0;
+    unsigned int src_pix_bytes = is_lcd ? 3 : 1;
+
+    const unsigned short *gamma_table = params->gamma_table;
+    const unsigned char *gamma_inv_table = params->gamma_inv_table;
+
+    __m128i fg[3];
+
+    fg[0] = _mm_set1_epi32( params->red );
+    fg[1] = _mm_set1_epi32( params->green );
+    fg[2] = _mm_set1_epi32( params->blue );
+
+    for( ; x + 4 <= width; x += 4 )
+    {
+      unsigned int lin[4] __attribute__(( aligned( 16 ) ));
+      unsigned int out[4] __attribute__(( aligned( 16 ) ));
+      __m128i cov, result;
+
+      cov = is_lcd ? _sse2_coverage_lcd( src + x * src_pix_bytes )
+                   : _sse2_coverage_gray( src + x * src_pix_bytes );
+
+      result = _mm_setzero_si128();
+
+      for( int c = 0; c < 3; c++ )
+      {
+        int shift = 16 - c * 8;
+        __m128i alpha, blended;
+
+        /* No gather in SSE2, the table lookups are done one at a time */
+        for( int i = 0; i < 4; i++ )
+          lin[i] = gamma_table[( dest[x + i] >> shift ) & 0xFF];
+
+        alpha = _mm_and_si128( _mm_srli_epi32( cov, shift ),
+                               _mm_set1_epi32( 0xFF ) );
+
+        blended = _sse2_linear_blend_epi32(
+                      _mm_load_si128( (const __m128i *) lin ), alpha, fg[c] );
+
+        _mm_store_si128( (__m128i *) out, blended );
+
+        for( int i = 0; i < 4; i++ )
+          out[i] = (unsigned int) gamma_inv_table[out[i]] << shift;
+
+        result = _mm_or_si128( result,
+                               _mm_load_si128( (const __m128i *) out ) );
+      }
+
+      _mm_storeu_si128( (__m128i *)( dest + x ), result );
+    }
+
+    if( is_lcd )
+      blend_kernels_scalar.linear_lcd( dest + x, src + x * 3, width - x,
+                                       params );
+    else
+      blend_kernels_scalar.linear_gray( dest + x, src + x, width - x,
+                                        params );
+  }
+
+
+  static _SSE2 void
+  _sse2_simple_gray( unsigned int *dest, const unsigned char *src,
+                     unsigned int width, const BlendParams *params )
+  {
+    _sse2_simple_row( dest, src, width, params, 0 );
+  }
+
+  static _SSE2 void
+  _sse2_simple_lcd( unsigned int *dest, const unsigned char *src,
+                    unsigned int width, const BlendParams *params )
+  {
+    _sse2_simple_row( dest, src, width, params, 1 );
+  }
+
+  static _SSE2 void
+  _sse2_linear_gray( unsigned int *dest, const unsigned char *src,
+                     unsigned int width, const BlendParams *params )
+  {
+    _sse2_linear_row( dest, src, width, params, 0 );
+  }
+
+  static _SSE2 void
+  _sse2_linear_lcd( unsigned int *dest, const unsigned char *src,
+                    unsigned int width, const BlendParams *params )
+  {
+    _sse2_linear_row( dest, src, width, params, 1 );
+  }
+
+
+  const BlendKernels blend_kernels_sse2 =
+  {
+    "SSE2",
+    GAMMA_LINEAR_BITS,
+    _sse2_simple_gray,
+    _sse2_simple_lcd,
+    _sse2_linear_gray,
+    _sse2_linear_lcd
+  };
+
+
+/* -------------------------------------------------------------------------- *\
+ *
+ *                              == AVX2 ==
+ *
+\* -------------------------------------------------------------------------- */
+
+  /* Coverage for 8 pixels, same layout as _sse2_coverage_gray() */
+  static inline _AVX2 __m256i
+  _avx2_coverage_gray( const unsigned char *src )
+  {
+    __m256i cov;
+
+    cov = _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i *) src ) );
+
+    return _mm256_mullo_epi32( cov, _mm256_set1_epi32( 0x010101 ) );
+  }
+
+
+  static inline _AVX2 __m256i
+  _avx2_coverage_lcd( const unsigned char *src )
+  {
+    /* Reverse each RGB triplet into BGR order and zero the top byte */
+    __m128i order = _mm_setr_epi8(  2,  1,  0, -1,  5,  4,  3, -1,
+                                    8,  7,  6, -1, 11, 10,  9, -1 );
+
+    /* Load exactly the 24 bytes used so the end of the bitmap isn't overrun */
+    __m128i first = _mm_loadu_si128( (const __m128i *) src );
+    __m128i second = _mm_loadl_epi64( (const __m128i *)( src + 16 ) );
+
+    __m128i lo = _mm_shuffle_epi8( first, order );
+    __m128i hi = _mm_shuffle_epi8( _mm_alignr_epi8( second, first, 12 ),
+                                   order );
+
+    return _mm256_inserti128_si256( _mm256_castsi128_si256( lo ), hi, 1 );
+  }
+
+
+  /*
+   * Look up 8 entries of a table without reading past the end of it. Each
+   * lookup gathers the aligned 32 bit word holding the entry and shifts it
+   * down. The table size in bytes must be a multiple of 4.
+   */
+  static inline _AVX2 __m256i
+  _avx2_lookup_u16( const unsigned short *table, __m256i index )
+  {
+    __m256i words = _mm256_i32gather_epi32( (const int *) table,
+                                            _mm256_srli_epi32( index, 1 ), 4 );
+    __m256i shift = _mm256_slli_epi32(
+                        _mm256_and_si256( index, _mm256_set1_epi32( 1 ) ), 4 );
+
+    return _mm256_and_si256( _mm256_srlv_epi32( words, shift ),
+                             _mm256_set1_epi32( 0xFFFF ) );
+  }
+
+
+  static inline _AVX2 __m256i
+  _avx2_lookup_u8( const unsigned char *table, __m256i index )
+  {
+    __m256i words = _mm256_i32gather_epi32( (const int *) table,
+                                            _mm256_srli_epi32( index, 2 ), 4 );
+    __m256i shift = _mm256_slli_epi32(
+                        _mm256_and_si256( index, _mm256_set1_epi32( 3 ) ), 3 );
+
+    return _mm256_and_si256( _mm256_srlv_epi32( words, shift ),
+                             _mm256_set1_epi32( 0xFF ) );
+  }
+
+
+  static inline _AVX2 __m256i
+  _avx2_simple_blend_epi16( __m256i bg, __m256i alpha, __m256i fg )
+  {
+    __m256i x;
+
+    x = _mm256_add_epi16(
+            _mm256_mullo_epi16( fg, alpha ),
+            _mm256_mullo_epi16( bg, _mm256_sub_epi16(
+                                        _mm256_set1_epi16( 255 ), alpha ) ) );
+
+    x = _mm256_add_epi16( x, _mm256_add_epi16( _mm256_set1_epi16( 1 ),
+                                               _mm256_srli_epi16( x, 8 ) ) );
+
+    return _mm256_srli_epi16( x, 8 );
+  }
+
+
+  static inline _AVX2 void
+  _avx2_simple_row( unsigned int         *dest,
+                    const unsigned char  *src,
+                    unsigned int          width,
+                    const BlendParams    *params,
+                    int                   is_lcd )
+  {
+    unsigned int x = 0;
+    unsigned int src_pix_bytes = is_lcd ? 3 : 1;
+
+    __m256i zero = _mm256_setzero_si256();
+    __m256i fg = _mm256_set1_epi64x( (long long) params->red   << 32 |
+                                     (long long) params->green << 16 |
+                                     (long long) params->blue );
+
+    for( ; x + 8 <= width; x += 8 )
+    {
+      __m256i dst, cov, lo, hi;
+
+      dst = _mm256_loadu_si256( (const __m256i *)( dest + x ) );
+      cov = is_lcd ? _avx2_coverage_lcd( src + x * src_pix_bytes )
+                   : _avx2_coverage_gray( src + x * src_pix_bytes );
+
+      /* Unpacking and packing both work within 128 bit lanes so the */
+      /* pixel order comes back out the same.                        */
+      lo = _avx2_simple_blend_epi16( _mm256_unpacklo_epi8( dst, zero ),
+                                     _mm256_unpacklo_epi8( cov, zero ), fg );
+      hi = _avx2_simple_blend_epi16( _mm256_unpackhi_epi8( dst, zero ),
+                                     _mm256_unpackhi_epi8( cov, zero ), fg );
+
+      dst = _mm256_and_si256( _mm256_packus_epi16( lo, hi ),
+                              _mm256_set1_epi32( 0x00FFFFFF ) );
+
+      _mm256_storeu_si256( (__m256i *)( dest + x ), dst );
+    }
+
+    if( is_lcd )
+      blend_kernels_scalar.simple_lcd( dest + x, src + x * 3, width - x,
+                                       params );
+    else
+      blend_kernels_scalar.simple_gray( dest + x, src + x, width - x,
+                                        params );
+  }
+
+
+  static inline _AVX2 __m256i
+  _avx2_linear_blend_epi32( __m256i bg, __m256i alpha, __m256i fg )
+  {
+    __m256i pair_color, pair_alpha, x;
+
+    pair_color = _mm256_or_si256( fg, _mm256_slli_epi32( bg, 16 ) );
+    pair_alpha = _mm256_or_si256( alpha,
+                                  _mm256_slli_epi32(
+                                      _mm256_sub_epi32(
+                                          _mm256_set1_epi32( 255 ),
+                                          alpha ), 16 ) );
+
+    x = _mm256_madd_epi16( pair_color, pair_alpha );
+
+    return _mm256_cvttps_epi32( _mm256_div_ps( _mm256_cvtepi32_ps( x ),
+                                               _mm256_set1_ps( 255.0f ) ) );
+  }
+
+
+  static inline _AVX2 void
+  _avx2_linear_row( unsigned int         *dest,
+                    const unsigned char  *src,
+                    unsigned int          width,
+                    const BlendParams    *params,
+                    int                   is_lcd )
+  {
+    unsigned int x = 0;
+    unsigned int src_pix_bytes = is_lcd ? 3 : 1;
+
+    __m256i byte_mask = _mm256_set1_epi32( 0xFF );
+    __m256i fg[3];
+
+    fg[0] = _mm256_set1_epi32( params->red );
+    fg[1] = _mm256_set1_epi32( params->green );
+    fg[2] = _mm256_set1_epi32( params->blue );
+
+    for( ; x + 8 <= width; x += 8 )
+    {
+      __m256i dst, cov, result;
+
+      dst = _mm256_loadu_si256( (const __m256i *)( dest + x ) );
+      cov = is_lcd ? _avx2_coverage_lcd( src + x * src_pix_bytes )
+                   : _avx2_coverage_gray( src + x * src_pix_bytes );
+
+      result = _mm256_setzero_si256();
+
+      for( int c = 0; c < 3; c++ )
+      {
+        __m128i shift = _mm_cvtsi32_si128( 16 - c * 8 );
+        __m256i bg, alpha, blended;
+
+        bg = _mm256_and_si256( _mm256_srl_epi32( dst, shift ), byte_mask );
+        bg = _avx2_lookup_u16( params->gamma_table, bg );
+
+        alpha = _mm256_and_si256( _mm256_srl_epi32( cov, shift ), byte_mask );
+
+        blended = _avx2_linear_blend_epi32( bg, alpha, fg[c] );
+        blended = _avx2_lookup_u8( params->gamma_inv_table, blended );
+
+        result = _mm256_or_si256( result, _mm256_sll_epi32( blended, shift ) );
+      }
+
+      _mm256_storeu_si256( (__m256i *)( dest + x ), result );
+    }
+
+    if( is_lcd )
+      blend_kernels_scalar.linear_lcd( dest + x, src + x * 3, width - x,
+                                       params );
+    else
+      blend_kernels_scalar.linear_gray( dest + x, src + x, width - x,
+                                        params );
+  }
+
+
+  static _AVX2 void
+  _avx2_simple_gray( unsigned int *dest, const unsigned char *src,
+                     unsigned int width, const BlendParams *params )
+  {
+    _avx2_simple_row( dest, src, width, params, 0 );
+  }
+
+  static _AVX2 void
+  _avx2_simple_lcd( unsigned int *dest, const unsigned char *src,
+                    unsigned int width, const BlendParams *params )
+  {
+    _avx2_simple_row( dest, src, width, params, 1 );
+  }
+
+  static _AVX2 void
+  _avx2_linear_gray( unsigned int *dest, const unsigned char *src,
+                     unsigned int width, const BlendParams *params )
+  {
+    _avx2_linear_row( dest, src, width, params, 0 );
+  }
+
+  static _AVX2 void
+  _avx2_linear_lcd( unsigned int *dest, const unsigned char *src,
+                    unsigned int width, const BlendParams *params )
+  {
+    _avx2_linear_row( dest, src, width, params, 1 );
+  }
+
+
+  const BlendKernels blend_kernels_avx2 =
+  {
+    "AVX2",
+    GAMMA_LINEAR_BITS,
+    _avx2_simple_gray,
+    _avx2_simple_lcd,
+    _avx2_linear_gray,
+    _avx2_linear_lcd
+  };
+
+
+#endif /* GLYPH_BLENDING_X86_KERNELS */
+
+/* END */
\ No newline at end of file
@@ -0,0 +1,459 @@
+#include "glyphcache.h"
+#include "outlineprocessing.h"
+#include "utils.h"
+
+#include <string.h>
+
+
+  static struct GlyphCache
+  {
+    /* Maps GlyphCacheKey -> GlyphCacheEntry */
+    GHashTable   *table;
+
+    /* Most recently used entries at the head */
+    GQueue        lru;
+
+    gsize         budget;
+    gsize         bytes_used;
+
+    guint64       hits;
+    guint64       misses;
+    guint64       evictions;
+    guint64       prefetch_hits;
+  } _cache;
+
+
+  static void
+  _evict_to_budget();
+
+
+  /* -------------------------------------------------------------------------- *\
+   *
+   *                           == Key functions ==
+   *
+  \* -------------------------------------------------------------------------- */
+
+  static guint
+  _hash_double( double value )
+  {
+    guint64 bits;
+
+    /* Avoid -0.0 and 0.0 hashing differently when they compare equal */
+    if( value == 0 )
+      value = 0;
+
+    memcpy( &bits, &value, sizeof( bits ) );
+    return (guint)( bits ^ ( bits >> 32 ) );
+  }
+
+
+  static guint
+  _key_hash( gconstpointer data )
+  {
+    const GlyphRasterKey *raster = &( (const GlyphCacheKey *) data )->raster;
+    const GlyphCompositeKey *composite =
+        &( (const GlyphCacheKey *) data )->composite;
+    guint hash;
+
+    hash = g_direct_hash( raster->face );
+    hash = hash * 31 + raster->glyph_index;
+    hash = hash * 31 + raster->text_size;
+    hash = hash * 31 + raster->resolution;
+    hash = hash * 31 + raster->hinting_mode;
+    hash = hash * 31 + ( raster->force_autohint ? 1 : 0 );
+    hash = hash * 31 + ( raster->lcd_rendering ? 1 : 0 );
+    hash = hash * 31 + raster->lcd_filter;
+    hash = hash * 31 + ( raster->direct_rendering ? 1 : 0 );
+    hash = hash * 31 + ( raster->coverage_only ? 1 : 0 );
+
+    hash = hash * 31 + ( composite->linear_blending ? 1 : 0 );
+    hash = hash * 31 + _hash_double( composite->gamma );
+    hash = hash * 31 + composite->gamma_linear_bits;
+
+    for( int i = 0; i < 3; i++ )
+    {
+      hash = hash * 31 + _hash_double( composite->fg[i] );
+      hash = hash * 31 + _hash_double( composite->bg[i] );
+    }
+
+    return hash;
+  }
+
+
+  gboolean
+  glyph_raster_key_equal( const GlyphRasterKey *a, const GlyphRasterKey *b )
+  {
+    return a->face            == b->face            &&
+           a->glyph_index     == b->glyph_index     &&
+           a->text_size       == b->text_size       &&
+           a->resolution      == b->resolution      &&
+           a->hinting_mode    == b->hinting_mode    &&
+           !a->force_autohint == !b->force_autohint &&
+           !a->lcd_rendering  == !b->lcd_rendering  &&
+           a->lcd_filter      == b->lcd_filter      &&
+           !a->direct_rendering == !b->direct_rendering &&
+           !a->coverage_only  == !b->coverage_only;
+  }
+
+
+  static gboolean
+  _composite_key_equal( const GlyphCompositeKey *a,
+                        const GlyphCompositeKey *b )
+  {
+    if( !a->linear_blending != !b->linear_blending ||
+        a->gamma != b->gamma                       ||
+        a->gamma_linear_bits != b->gamma_linear_bits )
+      return FALSE;
+
+    for( int i = 0; i < 3; i++ )
+    {
+      if( a->fg[i] != b->fg[i] || a->bg[i] != b->bg[i] )
+        return FALSE;
+    }
+
+    return TRUE;
+  }
+
+
+  static gboolean
+  _key_equal( gconstpointer a_data, gconstpointer b_data )
+  {
+    const GlyphCacheKey *a = a_data;
+    const GlyphCacheKey *b = b_data;
+
+    return glyph_raster_key_equal( &a->raster, &b->raster ) &&
+           _composite_key_equal( &a->composite, &b->composite );
+  }
+
+
+  /* -------------------------------------------------------------------------- *\
+   *
+   *                          == Entry functions ==
+   *
+  \* -------------------------------------------------------------------------- */
+
+  static gsize
+  _calculate_entry_size( GlyphCacheEntry *entry )
+  {
+    gsize size = sizeof( GlyphCacheEntry );
+
+    size += (gsize) cairo_image_surface_get_stride( entry->surface ) *
+                    cairo_image_surface_get_height( entry->surface );
+
+    if( entry->mask_surface )
+      size += (gsize) cairo_image_surface_get_stride( entry->mask_surface ) *
+                      cairo_image_surface_get_height( entry->mask_surface );
+
+    if( entry->magnified_surface )
+      size += (gsize)
+              cairo_image_surface_get_stride( entry->magnified_surface ) *
+              cairo_image_surface_get_height( entry->magnified_surface );
+
+    size += entry->outline.n_points * ( sizeof( FT_Vector ) + sizeof( char ) );
+    size += entry->outline.n_contours * sizeof( short );
+
+    if( entry->outline_path )
+      size += entry->outline_path->num_data * sizeof( cairo_path_data_t );
+
+    return size;
+  }
+
+
+  /*
+   * Copy an outline into memory owned by the viewer rather than a FT_Library,
+   * so copies can be made and freed from any thread. Free the copy with
+   * glyph_outline_free().
+   */
+  void
+  glyph_outline_copy( FT_Outline *dest, const FT_Outline *src )
+  {
+    dest->n_points   = src->n_points;
+    dest->n_contours = src->n_contours;
+    dest->points     = duplicate_memory( src->points,
+                                         src->n_points * sizeof( FT_Vector ) );
+    dest->tags       = duplicate_memory( src->tags,
+                                         src->n_points * sizeof( char ) );
+    dest->contours   = duplicate_memory( src->contours,
+                                         src->n_contours * sizeof( short ) );
+
+    /* Freetype mustn't try to free the arrays */
+    dest->flags      = src->flags & ~FT_OUTLINE_OWNER;
+  }
+
+
+  void
+  glyph_outline_free( FT_Outline *outline )
+  {
+    g_free( outline->points );
+    g_free( outline->tags );
+    g_free( outline->contours );
+
+    memset( outline, 0, sizeof( *outline ) );
+  }
+
+
+  /*
+   * Create a new entry for a glyph's outline and the blended surface made
+   * from it. The outline is copied, the entry takes ownership of the surface
+   * and is returned with a single reference held by the caller.
+   *
+   * This can be called from any thread, every other function here must only
+   * be called from the main thread.
+   */
+  GlyphCacheEntry *
+  glyph_cache_entry_new( const GlyphCacheKey  *key,
+                         const FT_Outline     *outline,
+                         FT_Int                bitmap_left,
+                         FT_Int                bitmap_top,
+                         cairo_surface_t      *surface )
+  {
+    GlyphCacheEntry *entry = g_new0( GlyphCacheEntry, 1 );
+
+    entry->key = *key;
+    entry->surface = surface;
+    entry->bitmap_left = bitmap_left;
+    entry->bitmap_top = bitmap_top;
+    entry->ref_count = 1;
+    entry->lru_link.data = entry;
+
+    glyph_outline_copy( &entry->outline, outline );
+    entry->outline_path = create_outline_path( outline );
+
+    entry->size = _calculate_entry_size( entry );
+
+    return entry;
+  }
+
+
+  /*
+   * Attach the expanded subpixel mask to an entry. The entry takes ownership
+   * of the surface.
+   */
+  void
+  glyph_cache_entry_set_mask_surface( GlyphCacheEntry  *entry,
+                                      cairo_surface_t  *mask_surface )
+  {
+    gsize old_size = entry->size;
+
+    if( entry->mask_surface )
+      cairo_surface_destroy( entry->mask_surface );
+
+    entry->mask_surface = mask_surface;
+    entry->size = _calculate_entry_size( entry );
+
+    if( entry->in_cache )
+    {
+      _cache.bytes_used += entry->size - old_size;
+      _evict_to_budget();
+    }
+  }
+
+
+  /*
+   * Attach the magnified image for a scale, replacing the one for any other
+   * scale. The entry takes ownership of the surface, which can be NULL to
+   * just drop the old one.
+   */
+  void
+  glyph_cache_entry_set_magnified_surface( GlyphCacheEntry  *entry,
+                                           cairo_surface_t  *surface,
+                                           int               scale,
+                                           gboolean          from_mask )
+  {
+    gsize old_size = entry->size;
+
+    if( entry->magnified_surface )
+      cairo_surface_destroy( entry->magnified_surface );
+
+    entry->magnified_surface = surface;
+    entry->magnified_scale = surface ? scale : 0;
+    entry->magnified_mask = from_mask;
+    entry->size = _calculate_entry_size( entry );
+
+    if( entry->in_cache )
+    {
+      _cache.bytes_used += entry->size - old_size;
+      _evict_to_budget();
+    }
+  }
+
+
+  GlyphCacheEntry *
+  glyph_cache_entry_ref( GlyphCacheEntry *entry )
+  {
+    entry->ref_count++;
+    return entry;
+  }
+
+
+  void
+  glyph_cache_entry_unref( GlyphCacheEntry *entry )
+  {
+    if( --entry->ref_count > 0 )
+      return;
+
+    cairo_surface_destroy( entry->surface );
+
+    if( entry->mask_surface )
+      cairo_surface_destroy( entry->mask_surface );
+
+    if( entry->magnified_surface )
+      cairo_surface_destroy( entry->magnified_surface );
+
+    glyph_outline_free( &entry->outline );
+    destroy_outline_path( entry->outline_path );
+    g_free( entry );
+  }
+
+
+  /* -------------------------------------------------------------------------- *\
+   *
+   *                          == Cache functions ==
+   *
+  \* -------------------------------------------------------------------------- */
+
+  /* Drop an entry from the cache. It survives if someone else holds a ref. */
+  static void
+  _remove_entry( GlyphCacheEntry *entry )
+  {
+    g_queue_unlink( &_cache.lru, &entry->lru_link );
+    g_hash_table_remove( _cache.table, &entry->key );
+
+    _cache.bytes_used -= entry->size;
+    entry->in_cache = FALSE;
+
+    glyph_cache_entry_unref( entry );
+  }
+
+
+  static void
+  _evict_to_budget()
+  {
+    while( _cache.bytes_used > _cache.budget && _cache.lru.tail )
+    {
+      _remove_entry( (GlyphCacheEntry *) _cache.lru.tail->data );
+      _cache.evictions++;
+    }
+  }
+
+
+  void
+  glyph_cache_init( gsize budget )
+  {
+    _cache.table = g_hash_table_new( _key_hash, _key_equal );
+    _cache.budget = budget;
+
+    g_queue_init( &_cache.lru );
+  }
+
+
+  void
+  glyph_cache_set_budget( gsize budget )
+  {
+    _cache.budget = budget;
+    _evict_to_budget();
+  }
+
+
+  /*
+   * Find the entry matching the key. Returns a new reference the caller must
+   * release or NULL if nothing was cached for the key.
+   */
+  GlyphCacheEntry *
+  glyph_cache_lookup( const GlyphCacheKey *key )
+  {
+    GlyphCacheEntry *entry = g_hash_table_lookup( _cache.table, key );
+
+    if( !entry )
+    {
+      _cache.misses++;
+      return NULL;
+    }
+
+    _cache.hits++;
+
+    if( entry->prefetched )
+    {
+      _cache.prefetch_hits++;
+      entry->prefetched = FALSE;
+    }
+
+    /* Move to the front of the LRU list */
+    g_queue_unlink( &_cache.lru, &entry->lru_link );
+    g_queue_push_head_link( &_cache.lru, &entry->lru_link );
+
+    return glyph_cache_entry_ref( entry );
+  }
+
+
+  /* Check for an entry without counting it as a use. */
+  gboolean
+  glyph_cache_contains( const GlyphCacheKey *key )
+  {
+    return g_hash_table_lookup( _cache.table, key ) != NULL;
+  }
+
+
+  /*
+   * Add an entry to the cache. The cache takes its own reference so the
+   * caller's reference is still valid afterwards. Any existing entry with the
+   * same key is replaced.
+   */
+  void
+  glyph_cache_insert( GlyphCacheEntry *entry )
+  {
+    GlyphCacheEntry *existing = g_hash_table_lookup( _cache.table,
+                                                     &entry->key );
+    if( existing == entry )
+      return;
+
+    if( existing )
+      _remove_entry( existing );
+
+    glyph_cache_entry_ref( entry );
+    g_hash_table_insert( _cache.table, &entry->key, entry );
+    g_queue_push_head_link( &_cache.lru, &entry->lru_link );
+
+    _cache.bytes_used += entry->size;
+    entry->in_cache = TRUE;
+
+    _evict_to_budget();
+  }
+
+
+  /*
+   * Remove every entry belonging to a face. Needs to be called before the face
+   * is freed since a new face could be allocated at the same address.
+   */
+  void
+  glyph_cache_purge_face( FT_Face face )
+  {
+    GList *link = _cache.lru.head;
+
+    while( link )
+    {
+      GList *next = link->next;
+      GlyphCacheEntry *entry = link->data;
+
+      if( entry->key.raster.face == face )
+        _remove_entry( entry );
+
+      link = next;
+    }
+  }
+
+
+  void
+  glyph_cache_get_stats( GlyphCacheStats *stats )
+  {
+    stats->hits          = _cache.hits;
+    stats->misses        = _cache.misses;
+    stats->evictions     = _cache.evictions;
+    stats->prefetch_hits = _cache.prefetch_hits;
+    stats->num_entries   = g_hash_table_size( _cache.table );
+    stats->bytes_used    = _cache.bytes_used;
+    stats->budget        = _cache.budget;
+  }
+
+
+/* END */
\ No newline at end of file
@@ -0,0 +1,195 @@
+#include <cairo.h>
+#include <glib.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_OUTLINE_H
+
+#ifndef GLYPH_CACHE_H_
+#define GLYPH_CACHE_H_
+
+/*
+ * Rasterized glyph cache
+ *
+ * Keeps the finished glyph surfaces (and the outline/metrics needed to draw
+ * them) around so that flipping back to a previously viewed set of settings
+ * doesn't need to go through Freetype and the blending code again. Entries are
+ * evicted in least recently used order once the memory budget is exceeded.
+ */
+
+/* Default memory budget for the cache in bytes */
+#define GLYPH_CACHE_DEFAULT_BUDGET ( 32 * 1024 * 1024 )
+
+
+  typedef enum
+  {
+    HINTING_MODE_NONE,
+    HINTING_MODE_LIGHT,
+    HINTING_MODE_NORMAL
+  } HintingMode;
+
+
+  /*
+   * Settings that affect the coverage bitmap Freetype produces for a glyph.
+   */
+  typedef struct GlyphRasterKeyRec_
+  {
+    FT_Face          face;
+    FT_UInt          glyph_index;
+    unsigned int     text_size;
+    unsigned int     resolution;
+    int              hinting_mode;
+    gboolean         force_autohint;
+    gboolean         lcd_rendering;
+    int              lcd_filter;
+
+    /* Rendered from the outline spans rather than the glyph slot bitmap */
+    gboolean         direct_rendering;
+
+    /* Only the coverage is kept (an A8 surface), color is applied when */
+    /* drawing                                                         */
+    gboolean         coverage_only;
+  } GlyphRasterKey;
+
+
+  /*
+   * Settings that affect how the coverage bitmap is blended into the glyph
+   * surface.
+   */
+  typedef struct GlyphCompositeKeyRec_
+  {
+    gboolean         linear_blending;
+    double           gamma;
+    unsigned int     gamma_linear_bits;
+
+    /* Colors the glyph was blended with (red, green, blue) */
+    double           fg[3];
+    double           bg[3];
+  } GlyphCompositeKey;
+
+
+  /*
+   * Everything that affects the rasterized glyph image. Two keys that compare
+   * equal will always produce the same glyph surface.
+   */
+  typedef struct GlyphCacheKeyRec_
+  {
+    GlyphRasterKey     raster;
+    GlyphCompositeKey  composite;
+  } GlyphCacheKey;
+
+
+  typedef struct GlyphCacheEntryRec_
+  {
+    GlyphCacheKey    key;
+
+    /* Blended glyph bitmap, or the coverage as a CAIRO_FORMAT_A8 surface */
+    /* for coverage only keys                                            */
+    cairo_surface_t *surface;
+
+    /* The surface with each subpixel expanded to a grey pixel, only built */
+    /* when the subpixel mask is first shown                               */
+    cairo_surface_t *mask_surface;
+
+    /* The surface (or the mask surface) scaled up to magnified_scale by */
+    /* pixel replication, kept for the zoom level last drawn at          */
+    cairo_surface_t *magnified_surface;
+    int              magnified_scale;
+    gboolean         magnified_mask;
+
+    /* Copy of the glyph's outline and the bitmap position */
+    FT_Outline       outline;
+
+    /* The outline decomposed into a path in glyph pixels (y up) so it */
+    /* doesn't need walked again each time it's drawn                  */
+    cairo_path_t    *outline_path;
+    FT_Int           bitmap_left;
+    FT_Int           bitmap_top;
+
+    /* Approximate memory used by the entry in bytes */
+    gsize            size;
+
+    gint             ref_count;
+
+    /* Set while the cache holds a reference to the entry */
+    gboolean         in_cache;
+
+    /* Made speculatively by the prefetcher and not looked up since */
+    gboolean         prefetched;
+
+    /* Link in the LRU list, data points back to the entry */
+    GList            lru_link;
+  } GlyphCacheEntry;
+
+
+  typedef struct GlyphCacheStatsRec_
+  {
+    guint64          hits;
+    guint64          misses;
+    guint64          evictions;
+
+    /* Hits on entries the prefetcher made before they were wanted */
+    guint64          prefetch_hits;
+
+    guint            num_entries;
+    gsize            bytes_used;
+    gsize            budget;
+  } GlyphCacheStats;
+
+
+  gboolean
+  glyph_raster_key_equal( const GlyphRasterKey *a, const GlyphRasterKey *b );
+
+  void
+  glyph_outline_copy( FT_Outline *dest, const FT_Outline *src );
+
+  void
+  glyph_outline_free( FT_Outline *outline );
+
+  void
+  glyph_cache_init( gsize budget );
+
+  void
+  glyph_cache_set_budget( gsize budget );
+
+  GlyphCacheEntry *
+  glyph_cache_lookup( const GlyphCacheKey *key );
+
+  GlyphCacheEntry *
+  glyph_cache_entry_new( const GlyphCacheKey  *key,
+                         const FT_Outline     *outline,
+                         FT_Int                bitmap_left,
+                         FT_Int                bitmap_top,
+                         cairo_surface_t      *surface );
+
+  gboolean
+  glyph_cache_contains( const GlyphCacheKey *key );
+
+  void
+  glyph_cache_insert( GlyphCacheEntry *entry );
+
+  void
+  glyph_cache_entry_set_mask_surface( GlyphCacheEntry  *entry,
+                                      cairo_surface_t  *mask_surface );
+
+  void
+  glyph_cache_entry_set_magnified_surface( GlyphCacheEntry  *entry,
+                                           cairo_surface_t  *surface,
+                                           int               scale,
+                                           gboolean          from_mask );
+
+  GlyphCacheEntry *
+  glyph_cache_entry_ref( GlyphCacheEntry *entry );
+
+  void
+  glyph_cache_entry_unref( GlyphCacheEntry *entry );
+
+  void
+  glyph_cache_purge_face( FT_Face face );
+
+  void
+  glyph_cache_get_stats( GlyphCacheStats *stats );
+
+
+#endif /* GLYPH_CACHE_H_ */
+
+/* END */
\ No newline at end of file
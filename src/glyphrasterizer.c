@@ -0,0 +1,1328 @@
+#include "glyphrasterizer.h"
+#include "glyphblending.h"
+#include "fontfile.h"
+#include "utils.h"
+
+#include FT_LCD_FILTER_H
+#include FT_CACHE_H
+#include FT_GLYPH_H
+#include FT_MODULE_H
+#include FT_SYSTEM_H
+#include <stdlib.h> /* for abs, malloc */
+#include <string.h>
+
+
+  /*
+   * The font the viewer has open. Jobs hold a reference so a worker can tell
+   * when it needs to open a different face, and results for a font that has
+   * since been closed can be thrown away.
+   */
+  typedef struct RasterFontRec_
+  {
+    gint             ref_count;
+
+    /* The viewer's face, only used to identify the font in cache keys */
+    FT_Face          face;
+
+    /* Mapping the workers open their faces on, the filename is only for */
+    /* messages                                                         */
+    GMappedFile     *file;
+    char            *filename;
+    FT_Long          face_index;
+  } RasterFont;
+
+
+  /*
+   * A loaded glyph before blending. The memory is owned by the viewer rather
+   * than a FT_Library so it can be shared between workers.
+   */
+  typedef struct GlyphCoverageRec_
+  {
+    gint             ref_count;
+
+    RasterFont      *font;
+    GlyphRasterKey   key;
+
+    /* Coverage bitmap, empty when rendering from the outline */
+    FT_Bitmap        bitmap;
+    FT_Int           bitmap_left;
+    FT_Int           bitmap_top;
+
+    FT_Outline       outline;
+  } GlyphCoverage;
+
+
+  typedef struct RasterJobRec_
+  {
+    GlyphCacheKey        key;
+    RasterFont          *font;
+
+    /* Value of _rasterizer.serial when requested, or of */
+    /* _rasterizer.prefetch_serial for prefetches        */
+    gint                 serial;
+
+    /* Speculative, only worked on when no real requests are waiting */
+    gboolean             prefetch;
+
+    /* Load through the worker's Freetype cache */
+    gboolean             use_ft_cache;
+
+    /* Only the composite settings changed since the last request, blend */
+    /* the coverage it loaded                                            */
+    gboolean             reblend;
+
+    /* Tells a worker to exit, only set on the jobs queued by */
+    /* glyph_rasterizer_shutdown()                            */
+    gboolean             stop;
+
+    /* Order jobs were queued in */
+    guint                order;
+
+    GlyphRasterizedFunc  callback;
+    gpointer             user_data;
+
+    /* The finished glyph, or NULL with the Freetype error if it couldn't */
+    /* be made, set by the worker                                        */
+    GlyphCacheEntry     *entry;
+    FT_Error             error;
+  } RasterJob;
+
+
+  /*
+   * What a bitmap rendered from an image cache outline depends on, apart
+   * from the font. A worker's bitmaps are dropped when its font changes.
+   */
+  typedef struct CachedBitmapKeyRec_
+  {
+    FT_UInt          glyph_index;
+    unsigned int     text_size;
+    unsigned int     resolution;
+    FT_Int32         load_flags;
+    FT_Render_Mode   render_mode;
+    int              lcd_filter;
+  } CachedBitmapKey;
+
+
+  typedef struct CachedBitmapRec_
+  {
+    CachedBitmapKey  key;
+
+    /* A FT_BitmapGlyph made by the worker's library */
+    FT_Glyph         glyph;
+    gsize            size;
+
+    GList            lru_link;
+  } CachedBitmap;
+
+
+  typedef struct RasterWorkerRec_
+  {
+    GThread         *thread;
+    FT_Library       library;
+
+    /* Allocator for library, counting allocations so Freetype cache misses */
+    /* can be spotted (only used by the worker's thread)                    */
+    struct FT_MemoryRec_  memory;
+    guint            allocations;
+
+    /* Face opened on font and the settings last applied to it */
+    RasterFont      *font;
+    FT_Face          face;
+    unsigned int     text_size;
+    unsigned int     resolution;
+    int              lcd_filter;
+
+    /* Freetype cache used instead of face when enabled, it has its own */
+    /* faces and sizes for the font ids it's been given                 */
+    FTC_Manager      manager;
+    FTC_ImageCache   images;
+    RasterFont      *cached_font;
+
+    /* Bitmaps rendered from the image cache's outlines, the image cache */
+    /* only keeps outlines. Maps CachedBitmapKey -> CachedBitmap, most  */
+    /* recently used at the head of bitmap_lru                          */
+    GHashTable      *bitmaps;
+    GQueue           bitmap_lru;
+    gsize            bitmap_bytes;
+  } RasterWorker;
+
+
+  static struct GlyphRasterizer
+  {
+    RasterWorker     workers[GLYPH_RASTERIZER_MAX_WORKERS];
+    guint            num_workers;
+
+    /* Queue of RasterJobs waiting for a worker */
+    GAsyncQueue     *jobs;
+
+    /* Font new requests are made for (main thread only) */
+    RasterFont      *font;
+
+    /* Bumped by each request, jobs with an older serial are superseded */
+    gint             serial;
+
+    /* Bumped each time the prefetches are replaced */
+    gint             prefetch_serial;
+
+    guint            next_order;
+
+    /* Last glyph loaded by any of the workers */
+    GMutex           coverage_lock;
+    GlyphCoverage   *coverage;
+
+    /* Completed and prefetched are only touched on the main thread, */
+    /* cancelled is atomic                                           */
+    guint64          completed;
+    guint64          prefetched;
+    gint             cancelled;
+
+    /* New jobs use the Freetype cache backend */
+    gboolean         use_ft_cache;
+
+    /* Freetype cache lookups and how many missed and had to be loaded, */
+    /* for each layer (atomic)                                          */
+    gint             ft_face_loads;
+    gint             ft_size_lookups;
+    gint             ft_size_loads;
+    gint             ft_image_lookups;
+    gint             ft_image_loads;
+    gint             ft_bitmap_lookups;
+    gint             ft_bitmap_renders;
+  } _rasterizer;
+
+
+  /* -------------------------------------------------------------------------- *\
+   *
+   *                      == Reference counted objects ==
+   *
+  \* -------------------------------------------------------------------------- */
+
+  static RasterFont *
+  _font_ref( RasterFont *font )
+  {
+    g_atomic_int_inc( &font->ref_count );
+    return font;
+  }
+
+
+  static void
+  _font_unref( RasterFont *font )
+  {
+    if( !g_atomic_int_dec_and_test( &font->ref_count ) )
+      return;
+
+    g_mapped_file_unref( font->file );
+    g_free( font->filename );
+    g_free( font );
+  }
+
+
+  static GlyphCoverage *
+  _coverage_ref( GlyphCoverage *coverage )
+  {
+    g_atomic_int_inc( &coverage->ref_count );
+    return coverage;
+  }
+
+
+  static void
+  _coverage_unref( GlyphCoverage *coverage )
+  {
+    if( !g_atomic_int_dec_and_test( &coverage->ref_count ) )
+      return;
+
+    if( coverage->font )
+      _font_unref( coverage->font );
+
+    g_free( coverage->bitmap.buffer );
+    glyph_outline_free( &coverage->outline );
+    g_free( coverage );
+  }
+
+
+  static void
+  _job_free( RasterJob *job )
+  {
+    if( job->entry )
+      glyph_cache_entry_unref( job->entry );
+
+    if( job->font )
+      _font_unref( job->font );
+
+    g_free( job );
+  }
+
+
+  /* -------------------------------------------------------------------------- *\
+   *
+   *                           == Rasterizing ==
+   *
+  \* -------------------------------------------------------------------------- */
+
+  static FT_Int32
+  _get_load_flags( const GlyphRasterKey *raster )
+  {
+    FT_Int32 load_flags = FT_LOAD_DEFAULT | FT_LOAD_NO_BITMAP;
+
+    if( raster->hinting_mode == HINTING_MODE_NONE )
+      load_flags |= FT_LOAD_NO_HINTING;
+
+    else if( raster->hinting_mode == HINTING_MODE_LIGHT )
+      load_flags |= FT_LOAD_TARGET_LIGHT;
+
+    else if( raster->hinting_mode == HINTING_MODE_NORMAL )
+      load_flags |= raster->lcd_rendering ? FT_LOAD_TARGET_LCD
+                                          : FT_LOAD_TARGET_NORMAL;
+
+    if( raster->hinting_mode != HINTING_MODE_NONE && raster->force_autohint )
+      load_flags |= FT_LOAD_FORCE_AUTOHINT;
+
+    return load_flags;
+  }
+
+
+  /* Is a bitmap needed or is the glyph blended from the outline? */
+  static gboolean
+  _needs_bitmap( const GlyphRasterKey *raster )
+  {
+    return !raster->direct_rendering && !raster->coverage_only;
+  }
+
+
+  static FT_Render_Mode
+  _get_render_mode( const GlyphRasterKey *raster )
+  {
+    return raster->lcd_rendering ? FT_RENDER_MODE_LCD : FT_RENDER_MODE_NORMAL;
+  }
+
+
+  /*
+   * Make a new coverage with a single reference from a loaded outline and
+   * the bitmap rendered from it (if any), copying both.
+   */
+  static GlyphCoverage *
+  _new_coverage( const GlyphRasterKey  *raster,
+                 const FT_Outline      *outline,
+                 const FT_Bitmap       *bitmap,
+                 FT_Int                 bitmap_left,
+                 FT_Int                 bitmap_top )
+  {
+    GlyphCoverage *coverage = g_new0( GlyphCoverage, 1 );
+
+    coverage->ref_count = 1;
+    coverage->key = *raster;
+
+    if( bitmap )
+    {
+      coverage->bitmap = *bitmap;
+      coverage->bitmap.buffer =
+          duplicate_memory( bitmap->buffer,
+                            (gsize) bitmap->rows * abs( bitmap->pitch ) );
+    }
+
+    coverage->bitmap_left = bitmap_left;
+    coverage->bitmap_top = bitmap_top;
+
+    glyph_outline_copy( &coverage->outline, outline );
+
+    return coverage;
+  }
+
+
+  /*
+   * Load the glyph with the face (already set to the key's size) and render
+   * it if it's going to be blended from a bitmap. Sets coverage to a new
+   * coverage with a single reference, or returns the Freetype error if the
+   * glyph couldn't be loaded or rendered.
+   */
+  static FT_Error
+  _load_coverage( FT_Face                face,
+                  const GlyphRasterKey  *raster,
+                  GlyphCoverage        **coverage )
+  {
+    FT_GlyphSlot slot;
+    FT_Error error;
+
+    error = FT_Load_Glyph( face, raster->glyph_index,
+                           _get_load_flags( raster ) );
+    if( error )
+      return error;
+
+    slot = face->glyph;
+
+    if( slot->format != FT_GLYPH_FORMAT_OUTLINE )
+      return FT_Err_Invalid_Glyph_Format;
+
+    /* Direct and coverage rendering work from the outline, no bitmap needed */
+    if( !_needs_bitmap( raster ) )
+    {
+      *coverage = _new_coverage( raster, &slot->outline, NULL,
+                                 slot->bitmap_left, slot->bitmap_top );
+      return FT_Err_Ok;
+    }
+
+    error = FT_Render_Glyph( slot, _get_render_mode( raster ) );
+    if( error )
+      return error;
+
+    *coverage = _new_coverage( raster, &slot->outline, &slot->bitmap,
+                               slot->bitmap_left, slot->bitmap_top );
+    return FT_Err_Ok;
+  }
+
+
+  /*
+   * Make the glyph surface for a key from its coverage. Nothing here touches
+   * the face so it works the same whichever thread loaded the coverage.
+   * Sets entry to a new cache entry with a reference for the caller, or
+   * returns the Freetype error if the outline couldn't be rendered.
+   */
+  static FT_Error
+  _blend_coverage( FT_Library             library,
+                   const GlyphCoverage   *coverage,
+                   const GlyphCacheKey   *key,
+                   GlyphCacheEntry      **entry )
+  {
+    const GlyphCompositeKey *composite = &key->composite;
+    const GammaTables *linear = NULL;
+    cairo_surface_t *surface;
+    FT_Int left, top;
+    FT_Error error;
+
+    if( composite->linear_blending )
+      linear = get_gamma_tables( composite->gamma,
+                                 composite->gamma_linear_bits );
+
+    if( key->raster.coverage_only || key->raster.direct_rendering )
+    {
+      FT_Outline outline;
+
+      /* Rendering moves the outline about, don't touch the shared one */
+      glyph_outline_copy( &outline, &coverage->outline );
+
+      if( key->raster.coverage_only )
+        error = render_outline_to_coverage_surface( library,
+                                                    &outline,
+                                                    &left,
+                                                    &top,
+                                                    &surface );
+      else
+        error = render_outline_to_solid_surface( library,
+                                                 &outline,
+                                                 composite->fg,
+                                                 composite->bg,
+                                                 linear,
+                                                 &left,
+                                                 &top,
+                                                 &surface );
+
+      glyph_outline_free( &outline );
+
+      if( error )
+        return error;
+    }
+    else
+    {
+      FT_Bitmap bitmap = coverage->bitmap;
+
+      surface = create_surface_for_ft_bitmap_dimensions( &bitmap );
+
+      /* The background is a single color so the blending can be done from */
+      /* precomputed tables instead of blending over a filled surface.     */
+      blend_glyph_to_solid_surface( &bitmap,
+                                    surface,
+                                    composite->fg,
+                                    composite->bg,
+                                    linear );
+
+      left = coverage->bitmap_left;
+      top = coverage->bitmap_top;
+    }
+
+    *entry = glyph_cache_entry_new( key, &coverage->outline, left, top,
+                                    surface );
+    return FT_Err_Ok;
+  }
+
+
+  /*
+   * Load and blend a glyph with the given library and face, which must
+   * already be set to the key's size. Sets entry to a new cache entry (not
+   * yet inserted into the cache) with a reference for the caller, or returns
+   * the Freetype error if the glyph couldn't be loaded, isn't an outline or
+   * couldn't be rendered.
+   *
+   * Can be called from any thread as long as the library and face are only
+   * used by that thread.
+   */
+  FT_Error
+  glyph_rasterize( FT_Library            library,
+                   FT_Face               face,
+                   const GlyphCacheKey  *key,
+                   GlyphCacheEntry     **entry )
+  {
+    GlyphCoverage *coverage;
+    FT_Error error = _load_coverage( face, &key->raster, &coverage );
+
+    if( error )
+      return error;
+
+    error = _blend_coverage( library, coverage, key, entry );
+    _coverage_unref( coverage );
+
+    return error;
+  }
+
+
+  static void
+  _worker_set_lcd_filter( RasterWorker *worker, int lcd_filter )
+  {
+    if( worker->lcd_filter != lcd_filter )
+    {
+      FT_Library_SetLcdFilter( worker->library, lcd_filter );
+      worker->lcd_filter = lcd_filter;
+    }
+  }
+
+
+  /* -------------------------------------------------------------------------- *\
+   *
+   *                      == Freetype cache backend ==
+   *
+  \* -------------------------------------------------------------------------- */
+
+  /*
+   * Instead of the worker's own face, glyphs can be loaded through a
+   * FTC_Manager and FTC_ImageCache. Faces and sizes are then kept by the
+   * manager (the RasterFont is the face id) rather than set again for each
+   * change, and loaded outlines are kept in the image cache within the
+   * manager's byte budget. Freetype doesn't report hits and misses so they're
+   * worked out from what gets created:
+   *
+   *   face         - the face requester is only called on a miss
+   *   size, image  - a lookup that hits only moves the node to the front,
+   *                  one that misses allocates the new node through the
+   *                  worker's FT_Memory
+   *
+   * The image cache keeps the outlines, bitmaps rendered from them are kept
+   * by the worker in a cache of its own so a glyph shown again (or blended
+   * again after a composite change) isn't rendered again. CMap and SBit
+   * caches aren't used, glyphs are requested by index and embedded bitmaps
+   * are never loaded.
+   */
+
+  static void *
+  _worker_alloc( FT_Memory memory, long size )
+  {
+    RasterWorker *worker = memory->user;
+
+    worker->allocations++;
+    return malloc( (size_t) size );
+  }
+
+
+  static void *
+  _worker_realloc( FT_Memory  memory,
+                   long       cur_size,
+                   long       new_size,
+                   void      *block )
+  {
+    RasterWorker *worker = memory->user;
+
+    worker->allocations++;
+    return realloc( block, (size_t) new_size );
+  }
+
+
+  static void
+  _worker_free( FT_Memory memory, void *block )
+  {
+    free( block );
+  }
+
+
+  static guint
+  _bitmap_key_hash( gconstpointer data )
+  {
+    const CachedBitmapKey *key = data;
+    guint hash;
+
+    hash = key->glyph_index;
+    hash = hash * 31 + key->text_size;
+    hash = hash * 31 + key->resolution;
+    hash = hash * 31 + (guint) key->load_flags;
+    hash = hash * 31 + key->render_mode;
+    hash = hash * 31 + (guint) key->lcd_filter;
+
+    return hash;
+  }
+
+
+  static gboolean
+  _bitmap_key_equal( gconstpointer a_data, gconstpointer b_data )
+  {
+    const CachedBitmapKey *a = a_data;
+    const CachedBitmapKey *b = b_data;
+
+    return a->glyph_index == b->glyph_index &&
+           a->text_size   == b->text_size   &&
+           a->resolution  == b->resolution  &&
+           a->load_flags  == b->load_flags  &&
+           a->render_mode == b->render_mode &&
+           a->lcd_filter  == b->lcd_filter;
+  }
+
+
+  static void
+  _worker_remove_bitmap( RasterWorker *worker, CachedBitmap *bitmap )
+  {
+    g_queue_unlink( &worker->bitmap_lru, &bitmap->lru_link );
+    g_hash_table_remove( worker->bitmaps, &bitmap->key );
+
+    worker->bitmap_bytes -= bitmap->size;
+
+    FT_Done_Glyph( bitmap->glyph );
+    g_free( bitmap );
+  }
+
+
+  /* Drop all the worker's bitmaps, they belong to the font it had. */
+  static void
+  _worker_clear_bitmaps( RasterWorker *worker )
+  {
+    while( worker->bitmap_lru.head )
+      _worker_remove_bitmap( worker, worker->bitmap_lru.head->data );
+  }
+
+
+  /*
+   * Get the bitmap for a job's glyph from the worker's bitmaps, rendering it
+   * from the outline the image cache gave and keeping it if it isn't there.
+   * Sets bitmap to a glyph the worker owns, only valid until the next call,
+   * or returns the Freetype error if it couldn't be rendered.
+   */
+  static FT_Error
+  _worker_get_bitmap( RasterWorker     *worker,
+                      RasterJob        *job,
+                      FT_Glyph          outline,
+                      FT_BitmapGlyph   *bitmap )
+  {
+    const GlyphRasterKey *raster = &job->key.raster;
+    CachedBitmapKey key;
+    CachedBitmap *cached;
+    FT_Glyph glyph = outline;
+    FT_Error error;
+
+    key.glyph_index = raster->glyph_index;
+    key.text_size   = raster->text_size;
+    key.resolution  = raster->resolution;
+    key.load_flags  = _get_load_flags( raster );
+    key.render_mode = _get_render_mode( raster );
+    key.lcd_filter  = raster->lcd_filter;
+
+    g_atomic_int_inc( &_rasterizer.ft_bitmap_lookups );
+
+    cached = g_hash_table_lookup( worker->bitmaps, &key );
+
+    if( cached )
+    {
+      g_queue_unlink( &worker->bitmap_lru, &cached->lru_link );
+      g_queue_push_head_link( &worker->bitmap_lru, &cached->lru_link );
+
+      *bitmap = (FT_BitmapGlyph) cached->glyph;
+      return FT_Err_Ok;
+    }
+
+    error = FT_Glyph_To_Bitmap( &glyph, key.render_mode, NULL, FALSE );
+    if( error )
+      return error;
+
+    g_atomic_int_inc( &_rasterizer.ft_bitmap_renders );
+
+    cached = g_new0( CachedBitmap, 1 );
+    cached->key = key;
+    cached->glyph = glyph;
+    cached->size = sizeof( *cached ) +
+                   (gsize)( (FT_BitmapGlyph) glyph )->bitmap.rows *
+                   abs( ( (FT_BitmapGlyph) glyph )->bitmap.pitch );
+    cached->lru_link.data = cached;
+
+    g_hash_table_insert( worker->bitmaps, &cached->key, cached );
+    g_queue_push_head_link( &worker->bitmap_lru, &cached->lru_link );
+    worker->bitmap_bytes += cached->size;
+
+    /* Never the new one, it's about to be used */
+    while( worker->bitmap_bytes > GLYPH_RASTERIZER_BITMAP_BUDGET &&
+           worker->bitmap_lru.tail != &cached->lru_link )
+      _worker_remove_bitmap( worker, worker->bitmap_lru.tail->data );
+
+    *bitmap = (FT_BitmapGlyph) glyph;
+    return FT_Err_Ok;
+  }
+
+
+  static FT_Error
+  _request_face( FTC_FaceID   face_id,
+                 FT_Library   library,
+                 FT_Pointer   request_data,
+                 FT_Face     *face )
+  {
+    RasterFont *font = face_id;
+
+    g_atomic_int_inc( &_rasterizer.ft_face_loads );
+
+    return font_file_new_face( library, font->file, font->face_index, face );
+  }
+
+
+  /*
+   * Get the Freetype cache ready for a job's font. Returns the Freetype error
+   * if the cache couldn't be made, it's tried again for the next job.
+   */
+  static FT_Error
+  _worker_prepare_ft_cache( RasterWorker *worker, RasterJob *job )
+  {
+    FT_Error error;
+
+    if( !worker->manager )
+    {
+      error = FTC_Manager_New( worker->library,
+                               GLYPH_RASTERIZER_FT_CACHE_FACES,
+                               GLYPH_RASTERIZER_FT_CACHE_SIZES,
+                               GLYPH_RASTERIZER_FT_CACHE_BUDGET,
+                               _request_face,
+                               NULL,
+                               &worker->manager );
+      if( error )
+      {
+        worker->manager = NULL;
+        return error;
+      }
+
+      error = FTC_ImageCache_New( worker->manager, &worker->images );
+      if( error )
+      {
+        FTC_Manager_Done( worker->manager );
+        worker->manager = NULL;
+        return error;
+      }
+
+      worker->bitmaps = g_hash_table_new( _bitmap_key_hash,
+                                          _bitmap_key_equal );
+    }
+
+    /* The old font's id could be reused by a new font once it's freed */
+    if( worker->cached_font != job->font )
+    {
+      if( worker->cached_font )
+      {
+        FTC_Manager_RemoveFaceID( worker->manager, worker->cached_font );
+        _worker_clear_bitmaps( worker );
+        _font_unref( worker->cached_font );
+      }
+
+      worker->cached_font = _font_ref( job->font );
+    }
+
+    _worker_set_lcd_filter( worker, job->key.raster.lcd_filter );
+
+    return FT_Err_Ok;
+  }
+
+
+  /*
+   * Load the coverage for a job through the Freetype cache. Sets coverage to
+   * a new coverage with a single reference, or returns the Freetype error if
+   * the glyph couldn't be loaded or rendered.
+   */
+  static FT_Error
+  _load_cached_coverage( RasterWorker    *worker,
+                         RasterJob       *job,
+                         GlyphCoverage  **coverage )
+  {
+    const GlyphRasterKey *raster = &job->key.raster;
+    FTC_ScalerRec scaler;
+    FT_Glyph glyph;
+    FT_BitmapGlyph bitmap;
+    FT_Size size;
+    FT_Error error;
+    guint allocations;
+
+    error = _worker_prepare_ft_cache( worker, job );
+    if( error )
+      return error;
+
+    scaler.face_id = job->font;
+    scaler.width   = raster->text_size * 64 / 2;
+    scaler.height  = raster->text_size * 64 / 2;
+    scaler.pixel   = 0;
+    scaler.x_res   = raster->resolution;
+    scaler.y_res   = raster->resolution;
+
+    allocations = worker->allocations;
+
+    error = FTC_Manager_LookupSize( worker->manager, &scaler, &size );
+    if( error )
+      return error;
+
+    g_atomic_int_inc( &_rasterizer.ft_size_lookups );
+
+    if( worker->allocations != allocations )
+      g_atomic_int_inc( &_rasterizer.ft_size_loads );
+
+    allocations = worker->allocations;
+
+    error = FTC_ImageCache_LookupScaler( worker->images,
+                                         &scaler,
+                                         _get_load_flags( raster ),
+                                         raster->glyph_index,
+                                         &glyph,
+                                         NULL );
+    if( error )
+      return error;
+
+    g_atomic_int_inc( &_rasterizer.ft_image_lookups );
+
+    if( worker->allocations != allocations )
+      g_atomic_int_inc( &_rasterizer.ft_image_loads );
+
+    if( glyph->format != FT_GLYPH_FORMAT_OUTLINE )
+      return FT_Err_Invalid_Glyph_Format;
+
+    /* The cache owns the glyph, it's copied before anything else is looked */
+    /* up in case it's flushed                                             */
+    if( !_needs_bitmap( raster ) )
+    {
+      *coverage = _new_coverage( raster,
+                                 &( (FT_OutlineGlyph) glyph )->outline,
+                                 NULL, 0, 0 );
+      return FT_Err_Ok;
+    }
+
+    error = _worker_get_bitmap( worker, job, glyph, &bitmap );
+    if( error )
+      return error;
+
+    *coverage = _new_coverage( raster,
+                               &( (FT_OutlineGlyph) glyph )->outline,
+                               &bitmap->bitmap,
+                               bitmap->left,
+                               bitmap->top );
+
+    return FT_Err_Ok;
+  }
+
+
+  /* -------------------------------------------------------------------------- *\
+   *
+   *                             == Workers ==
+   *
+  \* -------------------------------------------------------------------------- */
+
+  /* Queue order: real requests before prefetches, then oldest first. */
+  static gint
+  _compare_jobs( gconstpointer a, gconstpointer b, gpointer user_data )
+  {
+    const RasterJob *job_a = a;
+    const RasterJob *job_b = b;
+
+    if( job_a->prefetch != job_b->prefetch )
+      return job_a->prefetch ? 1 : -1;
+
+    return (gint)( job_a->order - job_b->order );
+  }
+
+
+  /*
+   * Make sure the worker's face is the job's font at the job's settings.
+   * Returns the Freetype error if the face couldn't be opened or sized, the
+   * worker then tries again for the next job.
+   */
+  static FT_Error
+  _worker_prepare( RasterWorker *worker, RasterJob *job )
+  {
+    const GlyphRasterKey *raster = &job->key.raster;
+    FT_Error error;
+
+    if( worker->font != job->font )
+    {
+      if( worker->face )
+        FT_Done_Face( worker->face );
+
+      if( worker->font )
+        _font_unref( worker->font );
+
+      worker->face = NULL;
+      worker->font = NULL;
+      worker->text_size = 0;
+      worker->resolution = 0;
+
+      error = font_file_new_face( worker->library,
+                                  job->font->file,
+                                  job->font->face_index,
+                                  &worker->face );
+      if( error )
+      {
+        worker->face = NULL;
+        return error;
+      }
+
+      worker->font = _font_ref( job->font );
+    }
+
+    if( worker->text_size != raster->text_size ||
+        worker->resolution != raster->resolution )
+    {
+      error = FT_Set_Char_Size( worker->face,
+                                raster->text_size * 64 / 2,
+                                raster->text_size * 64 / 2,
+                                raster->resolution,
+                                raster->resolution );
+      if( error )
+      {
+        worker->text_size = 0;
+        worker->resolution = 0;
+        return error;
+      }
+
+      worker->text_size = raster->text_size;
+      worker->resolution = raster->resolution;
+    }
+
+    _worker_set_lcd_filter( worker, raster->lcd_filter );
+
+    return FT_Err_Ok;
+  }
+
+
+  /*
+   * Get the coverage for a job. The last coverage loaded for a request is
+   * kept so a re-blend after a composite change (gamma, blending, colors)
+   * doesn't go near Freetype. Its raster settings still have to match, a
+   * composite change can switch between coverage only and blended glyphs,
+   * otherwise it's loaded again. Prefetches don't replace it since it's the
+   * glyph on screen that's likely to be re-blended.
+   *
+   * Sets coverage to a new reference, or returns the Freetype error if the
+   * glyph couldn't be loaded.
+   */
+  static FT_Error
+  _worker_get_coverage( RasterWorker    *worker,
+                        RasterJob       *job,
+                        GlyphCoverage  **coverage )
+  {
+    GlyphCoverage *old;
+    FT_Error error;
+
+    *coverage = NULL;
+
+    if( job->reblend )
+    {
+      g_mutex_lock( &_rasterizer.coverage_lock );
+
+      if( _rasterizer.coverage                       &&
+          _rasterizer.coverage->font == job->font    &&
+          glyph_raster_key_equal( &_rasterizer.coverage->key,
+                                  &job->key.raster ) )
+        *coverage = _coverage_ref( _rasterizer.coverage );
+
+      g_mutex_unlock( &_rasterizer.coverage_lock );
+
+      if( *coverage )
+        return FT_Err_Ok;
+    }
+
+    if( job->use_ft_cache )
+      error = _load_cached_coverage( worker, job, coverage );
+    else
+    {
+      error = _worker_prepare( worker, job );
+      if( !error )
+        error = _load_coverage( worker->face, &job->key.raster, coverage );
+    }
+
+    if( error )
+      return error;
+
+    ( *coverage )->font = _font_ref( job->font );
+
+    if( job->prefetch )
+      return FT_Err_Ok;
+
+    g_mutex_lock( &_rasterizer.coverage_lock );
+    old = _rasterizer.coverage;
+    _rasterizer.coverage = _coverage_ref( *coverage );
+    g_mutex_unlock( &_rasterizer.coverage_lock );
+
+    if( old )
+      _coverage_unref( old );
+
+    return FT_Err_Ok;
+  }
+
+
+  /*
+   * Back on the main loop with a finished job. A glyph that couldn't be made
+   * is only passed on for a real request, failed prefetches are dropped since
+   * nobody asked for them.
+   */
+  static gboolean
+  _job_finished( gpointer data )
+  {
+    RasterJob *job = data;
+
+    _rasterizer.completed++;
+
+    /* Glyphs for a font that's since been closed are no use to anyone */
+    if( job->font != _rasterizer.font || ( job->error && job->prefetch ) )
+    {
+      _job_free( job );
+      return FALSE;
+    }
+
+    if( job->error )
+    {
+      if( job->callback )
+        job->callback( NULL, job->error, (guint) job->serial,
+                       job->user_data );
+    }
+    else if( job->prefetch )
+    {
+      /* Don't replace one that was asked for while this was being made */
+      if( !glyph_cache_contains( &job->entry->key ) )
+      {
+        job->entry->prefetched = TRUE;
+        glyph_cache_insert( job->entry );
+        _rasterizer.prefetched++;
+      }
+    }
+    else
+    {
+      /* Superseded glyphs are still worth keeping if they were finished */
+      glyph_cache_insert( job->entry );
+
+      if( job->callback )
+        job->callback( job->entry, FT_Err_Ok, (guint) job->serial,
+                       job->user_data );
+    }
+
+    _job_free( job );
+
+    return FALSE;
+  }
+
+
+  static gpointer
+  _worker_main( gpointer data )
+  {
+    RasterWorker *worker = data;
+
+    for( ;; )
+    {
+      RasterJob *job = g_async_queue_pop( _rasterizer.jobs );
+      GlyphCoverage *coverage;
+      gint serial;
+
+      if( job->stop )
+      {
+        _job_free( job );
+        break;
+      }
+
+      serial = job->prefetch
+               ? g_atomic_int_get( &_rasterizer.prefetch_serial )
+               : g_atomic_int_get( &_rasterizer.serial );
+
+      /* Don't bother with requests replaced while they were waiting */
+      if( job->serial != serial )
+      {
+        g_atomic_int_inc( &_rasterizer.cancelled );
+        _job_free( job );
+        continue;
+      }
+
+      /* A glyph that can't be loaded or rendered goes back with its */
+      /* error, it mustn't take the viewer down with it              */
+      job->error = _worker_get_coverage( worker, job, &coverage );
+
+      if( !job->error )
+      {
+        job->error = _blend_coverage( worker->library, coverage, &job->key,
+                                      &job->entry );
+        _coverage_unref( coverage );
+      }
+
+      g_idle_add( _job_finished, job );
+    }
+
+    return NULL;
+  }
+
+
+  /* -------------------------------------------------------------------------- *\
+   *
+   *                          == Main thread API ==
+   *
+  \* -------------------------------------------------------------------------- */
+
+  void
+  glyph_rasterizer_init()
+  {
+    _rasterizer.num_workers = CLAMP( g_get_num_processors(),
+                                     1, GLYPH_RASTERIZER_MAX_WORKERS );
+    _rasterizer.jobs = g_async_queue_new();
+
+    for( guint i = 0; i < _rasterizer.num_workers; i++ )
+    {
+      RasterWorker *worker = &_rasterizer.workers[i];
+
+      worker->memory.user    = worker;
+      worker->memory.alloc   = _worker_alloc;
+      worker->memory.free    = _worker_free;
+      worker->memory.realloc = _worker_realloc;
+
+      /* What FT_Init_FreeType() does, with the worker's allocator */
+      if( FT_New_Library( &worker->memory, &worker->library ) )
+        panic( "Couldn't initalize Freetype for rasterizing" );
+
+      FT_Add_Default_Modules( worker->library );
+      FT_Set_Default_Properties( worker->library );
+
+      worker->lcd_filter = -1;
+      worker->thread = g_thread_new( "rasterizer", _worker_main, worker );
+    }
+  }
+
+
+  /*
+   * Stop the workers and free everything the rasterizer holds. Jobs still
+   * waiting are dropped, any already finished but not yet handed back are
+   * thrown away when they get to the main loop.
+   */
+  void
+  glyph_rasterizer_shutdown()
+  {
+    RasterJob *job;
+
+    glyph_rasterizer_cancel();
+    glyph_rasterizer_cancel_prefetch();
+
+    /* One each, after anything already queued */
+    for( guint i = 0; i < _rasterizer.num_workers; i++ )
+    {
+      job = g_new0( RasterJob, 1 );
+      job->stop = TRUE;
+      job->order = _rasterizer.next_order++;
+
+      g_async_queue_push_sorted( _rasterizer.jobs, job, _compare_jobs, NULL );
+    }
+
+    for( guint i = 0; i < _rasterizer.num_workers; i++ )
+    {
+      RasterWorker *worker = &_rasterizer.workers[i];
+
+      g_thread_join( worker->thread );
+
+      if( worker->face )
+        FT_Done_Face( worker->face );
+
+      if( worker->font )
+        _font_unref( worker->font );
+
+      if( worker->bitmaps )
+      {
+        _worker_clear_bitmaps( worker );
+        g_hash_table_destroy( worker->bitmaps );
+      }
+
+      if( worker->manager )
+        FTC_Manager_Done( worker->manager );
+
+      if( worker->cached_font )
+        _font_unref( worker->cached_font );
+
+      /* Not FT_Done_FreeType(), the memory isn't Freetype's to free */
+      FT_Done_Library( worker->library );
+
+      memset( worker, 0, sizeof( *worker ) );
+    }
+
+    /* Prefetches queued behind the stop jobs */
+    while( ( job = g_async_queue_try_pop( _rasterizer.jobs ) ) )
+      _job_free( job );
+
+    g_async_queue_unref( _rasterizer.jobs );
+    _rasterizer.jobs = NULL;
+    _rasterizer.num_workers = 0;
+
+    if( _rasterizer.coverage )
+      _coverage_unref( _rasterizer.coverage );
+    _rasterizer.coverage = NULL;
+
+    if( _rasterizer.font )
+      _font_unref( _rasterizer.font );
+    _rasterizer.font = NULL;
+  }
+
+
+  /*
+   * Set the font that requests are for. The face must have been opened with
+   * font_file_new_face(), it's only used to identify the font and find the
+   * mapping each worker opens its own face from.
+   */
+  void
+  glyph_rasterizer_set_font( FT_Face face, const char *filename )
+  {
+    RasterFont *font = g_new0( RasterFont, 1 );
+    GlyphCoverage *old;
+
+    font->ref_count = 1;
+    font->face = face;
+    font->file = g_mapped_file_ref( font_file_get_for_face( face ) );
+    font->filename = g_strdup( filename );
+    font->face_index = face->face_index;
+
+    glyph_rasterizer_cancel();
+    glyph_rasterizer_cancel_prefetch();
+
+    if( _rasterizer.font )
+      _font_unref( _rasterizer.font );
+
+    _rasterizer.font = font;
+
+    g_mutex_lock( &_rasterizer.coverage_lock );
+    old = _rasterizer.coverage;
+    _rasterizer.coverage = NULL;
+    g_mutex_unlock( &_rasterizer.coverage_lock );
+
+    if( old )
+      _coverage_unref( old );
+  }
+
+
+  /*
+   * Rasterize the glyph for a key in the background. Any earlier requests
+   * are superseded: if they haven't started they're dropped, if they finish
+   * anyway they still call back with their (older) serial. Returns the
+   * request's serial.
+   *
+   * Set reblend when only the composite settings have changed since the last
+   * request, the glyph is then blended from the coverage that request loaded
+   * instead of being loaded again.
+   */
+  guint
+  glyph_rasterizer_request( const GlyphCacheKey  *key,
+                            gboolean              reblend,
+                            GlyphRasterizedFunc   callback,
+                            gpointer              user_data )
+  {
+    RasterJob *job = g_new0( RasterJob, 1 );
+
+    if( !_rasterizer.font )
+      panic( "glyph_rasterizer_request: no font set" );
+
+    g_atomic_int_inc( &_rasterizer.serial );
+
+    job->key = *key;
+    job->font = _font_ref( _rasterizer.font );
+    job->serial = g_atomic_int_get( &_rasterizer.serial );
+    job->callback = callback;
+    job->user_data = user_data;
+    job->use_ft_cache = _rasterizer.use_ft_cache;
+    job->reblend = reblend;
+    job->order = _rasterizer.next_order++;
+
+    g_async_queue_push_sorted( _rasterizer.jobs, job, _compare_jobs, NULL );
+
+    return (guint) job->serial;
+  }
+
+
+  /*
+   * Supersede any outstanding requests without making a new one. Returns a
+   * serial newer than any of theirs.
+   */
+  guint
+  glyph_rasterizer_cancel()
+  {
+    g_atomic_int_inc( &_rasterizer.serial );
+
+    return (guint) g_atomic_int_get( &_rasterizer.serial );
+  }
+
+
+  /*
+   * Rasterize a glyph that might be wanted soon into the cache. Prefetches
+   * are only started when there are no requests waiting and don't supersede
+   * anything, but are dropped by glyph_rasterizer_cancel_prefetch().
+   */
+  void
+  glyph_rasterizer_prefetch( const GlyphCacheKey *key )
+  {
+    RasterJob *job;
+
+    if( !_rasterizer.font || glyph_cache_contains( key ) )
+      return;
+
+    job = g_new0( RasterJob, 1 );
+
+    job->key = *key;
+    job->font = _font_ref( _rasterizer.font );
+    job->serial = g_atomic_int_get( &_rasterizer.prefetch_serial );
+    job->prefetch = TRUE;
+    job->use_ft_cache = _rasterizer.use_ft_cache;
+    job->order = _rasterizer.next_order++;
+
+    g_async_queue_push_sorted( _rasterizer.jobs, job, _compare_jobs, NULL );
+  }
+
+
+  /* Drop any prefetches that haven't been started. */
+  void
+  glyph_rasterizer_cancel_prefetch()
+  {
+    g_atomic_int_inc( &_rasterizer.prefetch_serial );
+  }
+
+
+  void
+  glyph_rasterizer_get_stats( GlyphRasterizerStats *stats )
+  {
+    stats->num_workers = _rasterizer.num_workers;
+    stats->completed   = _rasterizer.completed;
+    stats->prefetched  = _rasterizer.prefetched;
+    stats->cancelled   = (guint) g_atomic_int_get( &_rasterizer.cancelled );
+
+    stats->ft_cache_enabled = _rasterizer.use_ft_cache;
+    stats->ft_cache_budget  = (gsize)( GLYPH_RASTERIZER_FT_CACHE_BUDGET +
+                                       GLYPH_RASTERIZER_BITMAP_BUDGET ) *
+                              _rasterizer.num_workers;
+    stats->ft_face_loads    = (guint) g_atomic_int_get(
+                                          &_rasterizer.ft_face_loads );
+    stats->ft_size_lookups  = (guint) g_atomic_int_get(
+                                          &_rasterizer.ft_size_lookups );
+    stats->ft_size_loads    = (guint) g_atomic_int_get(
+                                          &_rasterizer.ft_size_loads );
+    stats->ft_image_lookups = (guint) g_atomic_int_get(
+                                          &_rasterizer.ft_image_lookups );
+    stats->ft_image_loads   = (guint) g_atomic_int_get(
+                                          &_rasterizer.ft_image_loads );
+    stats->ft_bitmap_lookups = (guint) g_atomic_int_get(
+                                          &_rasterizer.ft_bitmap_lookups );
+    stats->ft_bitmap_renders = (guint) g_atomic_int_get(
+                                          &_rasterizer.ft_bitmap_renders );
+  }
+
+
+  /*
+   * Choose whether glyphs requested from now on are loaded through the
+   * Freetype cache backend. The glyphs are the same either way.
+   */
+  void
+  glyph_rasterizer_set_use_ft_cache( gboolean use_ft_cache )
+  {
+    _rasterizer.use_ft_cache = use_ft_cache;
+  }
+
+
+/* END */
\ No newline at end of file
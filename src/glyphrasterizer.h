@@ -0,0 +1,120 @@
+#include "glyphcache.h"
+
+#include <glib.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#ifndef GLYPH_RASTERIZER_H_
+#define GLYPH_RASTERIZER_H_
+
+/*
+ * Background glyph rasterization
+ *
+ * Loading, rendering and blending a glyph is done on a pool of worker threads
+ * so a slow glyph (heavily hinted, large sizes) doesn't hold up the UI.
+ * Freetype objects can't be shared between threads so each worker has its own
+ * FT_Library and FT_Face opened on the same mapped font file as the viewer's
+ * face.
+ * Finished glyphs are handed back on the main loop.
+ *
+ * Apart from glyph_rasterize() the functions must be called from the main
+ * thread.
+ */
+
+/* Upper limit on the number of worker threads */
+#define GLYPH_RASTERIZER_MAX_WORKERS 4
+
+/* Limits for each worker's Freetype cache when that backend is used */
+#define GLYPH_RASTERIZER_FT_CACHE_FACES  2
+#define GLYPH_RASTERIZER_FT_CACHE_SIZES  8
+#define GLYPH_RASTERIZER_FT_CACHE_BUDGET ( 2 * 1024 * 1024 )
+
+/* Limit on the bitmaps each worker renders from the Freetype cache's */
+/* outlines and keeps                                                 */
+#define GLYPH_RASTERIZER_BITMAP_BUDGET   ( 2 * 1024 * 1024 )
+
+
+  /*
+   * Called on the main loop with a finished glyph and the serial of the
+   * request it was made for. Superseded requests that were already being
+   * worked on still call back, so results can arrive out of order. The entry
+   * has already been added to the glyph cache, the callback needs to take its
+   * own reference if it keeps it. If the glyph couldn't be loaded the entry
+   * is NULL and error is the Freetype error.
+   */
+  typedef void
+  (*GlyphRasterizedFunc)( GlyphCacheEntry  *entry,
+                          FT_Error          error,
+                          guint             serial,
+                          gpointer          user_data );
+
+
+  typedef struct GlyphRasterizerStatsRec_
+  {
+    guint            num_workers;
+
+    /* Glyphs finished by the workers */
+    guint64          completed;
+
+    /* Prefetched glyphs added to the cache */
+    guint64          prefetched;
+
+    /* Requests dropped because a newer one replaced them */
+    guint64          cancelled;
+
+    /* Freetype cache backend, the budget is the total for all workers */
+    /* including their bitmaps. Faces are only counted when loaded,    */
+    /* each size, image or bitmap lookup is counted and the loads and  */
+    /* renders are the lookups that missed                             */
+    gboolean         ft_cache_enabled;
+    gsize            ft_cache_budget;
+    guint64          ft_face_loads;
+    guint64          ft_size_lookups;
+    guint64          ft_size_loads;
+    guint64          ft_image_lookups;
+    guint64          ft_image_loads;
+    guint64          ft_bitmap_lookups;
+    guint64          ft_bitmap_renders;
+  } GlyphRasterizerStats;
+
+
+  void
+  glyph_rasterizer_init();
+
+  void
+  glyph_rasterizer_shutdown();
+
+  void
+  glyph_rasterizer_set_font( FT_Face face, const char *filename );
+
+  guint
+  glyph_rasterizer_request( const GlyphCacheKey  *key,
+                            gboolean              reblend,
+                            GlyphRasterizedFunc   callback,
+                            gpointer              user_data );
+
+  guint
+  glyph_rasterizer_cancel();
+
+  void
+  glyph_rasterizer_prefetch( const GlyphCacheKey *key );
+
+  void
+  glyph_rasterizer_cancel_prefetch();
+
+  void
+  glyph_rasterizer_get_stats( GlyphRasterizerStats *stats );
+
+  void
+  glyph_rasterizer_set_use_ft_cache( gboolean use_ft_cache );
+
+  FT_Error
+  glyph_rasterize( FT_Library            library,
+                   FT_Face               face,
+                   const GlyphCacheKey  *key,
+                   GlyphCacheEntry     **entry );
+
+
+#endif /* GLYPH_RASTERIZER_H_ */
+
+/* END */
\ No newline at end of file
@@ -1,13 +1,19 @@
 #include "glyphblending.h"
+#include "glyphcache.h"
 
 #include <gtk/gtk.h>
 #include <glib.h>
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include FT_LCD_FILTER_H
 
 #ifndef GLYPH_VIEWER_GLOBALS_H_
 #define GLYPH_VIEWER_GLOBALS_H_
 
+/* Time in microseconds a glyph should be shown within to keep up with */
+/* the display (one frame at 60Hz)                                     */
+#define RENDER_FRAME_TIME 16667
+
 
   typedef struct ViewerColorRec_
   {
@@ -17,12 +23,39 @@
   } ViewerColor;
 
 
+  /*
+   * How much of the display pipeline needs redone after a setting changes.
+   */
   typedef enum
   {
-    HINTING_MODE_NONE,
-    HINTING_MODE_LIGHT,
-    HINTING_MODE_NORMAL
-  } HintingMode;
+    /* Only the scale or origin changed, repaint using the same surface */
+    INVALIDATE_VIEW,
+
+    /* Colors or blending changed, re-blend the glyph coverage */
+    INVALIDATE_COMPOSITE,
+
+    /* The glyph, size or rendering settings changed, load it again */
+    INVALIDATE_RASTER
+  } InvalidationLevel;
+
+
+  /*
+   * Latency of glyph requests, from the settings changing to the glyph for
+   * them being shown (times in microseconds). Requests replaced by a newer
+   * one before they were shown are never timed.
+   */
+  typedef struct RenderStatsRec_
+  {
+    guint64  requests;
+    guint64  shown;
+
+    /* Shown requests that took longer than RENDER_FRAME_TIME */
+    guint64  over_frame;
+
+    gint64   last_latency;
+    gint64   max_latency;
+    gint64   total_latency;
+  } RenderStats;
 
 
   typedef struct GlyphViewerGlobalsRec_
@@ -66,6 +99,17 @@
     /* Should use subpixel rendering (also use lcd mode for normal hinting) */
     gboolean           lcd_rendering;
 
+    /* The filter set on the library for subpixel rendering */
+    FT_LcdFilter       lcd_filter;
+
+    /* Render greyscale glyphs from the outline spans straight into the */
+    /* glyph surface instead of going through FT_Render_Glyph           */
+    gboolean           direct_rendering;
+
+    /* Keep greyscale glyphs as coverage and composite them with the text */
+    /* color through a cairo mask (not used for linear blending)          */
+    gboolean           coverage_masking;
+
     /* Draw each subpixel as a greyscale trio instead of a RGB pixel */
     gboolean           show_subpixel_mask;
 
@@ -75,14 +119,19 @@
     /* The currently set gamma correction factor when doing linear blending */
     double             gamma;
 
-    /* Table to convert from the normal RGB colorspace to linear */
-    unsigned short     gamma_table[256];
+    /* Bits of precision for linear values when doing linear blending */
+    unsigned int       gamma_linear_bits;
+
+    /* The glyph being displayed, holds a reference to the cache entry */
+    /* so the blended bitmap doesn't need rasterized each time          */
+    GlyphCacheEntry   *glyph;
 
-    /* Table to convert from linear back to the normal RGB colorspace */
-    unsigned char      gamma_inv_table[GAMMA_LINEAR_NUM_VALUES];
+    /* Memory budget for the rasterized glyph cache in bytes */
+    gsize              glyph_cache_budget;
 
-    /* Blended glyph bitmap so it doesn't need rasterized each time */
-    cairo_surface_t   *glyph_surface;
+    /* Number of glyphs either side of the current one to rasterize ahead */
+    /* of time, 0 turns prefetching off                                   */
+    unsigned int       prefetch_depth;
 
     /* Scale factor to inflate the glyph outline and bitmap by */
     FT_F26Dot6         scale;
@@ -116,6 +165,9 @@
     ViewerColor        on_point_color;
 
     ViewerColor        ctrl_point_color;
+
+    /* Radius of the point markers in pixels */
+    double             point_radius;
   } GlyphViewerGlobals;
 
 
@@ -123,7 +175,7 @@
 
 
   void
-  switch_font( FT_Face face );
+  switch_font( FT_Face face, const char *filename );
 
   void
   set_face_size();
@@ -131,9 +183,18 @@
   void
   setup_glyph();
 
+  void
+  get_render_stats( RenderStats *stats );
+
+  void
+  invalidate_glyph( InvalidationLevel level );
+
   void
   invalidate_drawing_area();
 
+  void
+  pan_drawing_area( int x_origin, int y_origin );
+
   GtkWidget *
   get_builder_widget( const gchar *name );
 
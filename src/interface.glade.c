@@ -366,6 +366,15 @@ const char* GLADE_STRING = "<?xml version=\"1.0\" encoding=\"UTF-8\"?> \
                         <property name=\"use_underline\">True</property> \
                       </object> \
                     </child> \
+                    <child> \
+                      <object class=\"GtkCheckMenuItem\" id=\"gamma_high_precision\"> \
+                        <property name=\"visible\">True</property> \
+                        <property name=\"sensitive\">False</property> \
+                        <property name=\"can_focus\">False</property> \
+                        <property name=\"label\" translatable=\"yes\">High Precision Linear Blending</property> \
+                        <property name=\"use_underline\">True</property> \
+                      </object> \
+                    </child> \
                     <child> \
                       <object class=\"GtkSeparatorMenuItem\" id=\"settings_sep_1\"> \
                         <property name=\"visible\">True</property> \
@@ -439,6 +448,112 @@ const char* GLADE_STRING = "<?xml version=\"1.0\" encoding=\"UTF-8\"?> \
                         </child> \
                       </object> \
                     </child> \
+                    <child> \
+                      <object class=\"GtkMenuItem\" id=\"prefetch_submenu_entry\"> \
+                        <property name=\"visible\">True</property> \
+                        <property name=\"can_focus\">False</property> \
+                        <property name=\"label\" translatable=\"yes\">Prefetch Neighbouring Glyphs</property> \
+                        <property name=\"use_underline\">True</property> \
+                        <child type=\"submenu\"> \
+                          <object class=\"GtkMenu\" id=\"prefetch_submenu\"> \
+                            <property name=\"visible\">True</property> \
+                            <property name=\"can_focus\">False</property> \
+                            <child> \
+                              <object class=\"GtkRadioMenuItem\" id=\"prefetch_off\"> \
+                                <property name=\"visible\">True</property> \
+                                <property name=\"can_focus\">False</property> \
+                                <property name=\"label\" translatable=\"yes\">Off</property> \
+                                <property name=\"use_underline\">True</property> \
+                                <property name=\"draw_as_radio\">True</property> \
+                              </object> \
+                            </child> \
+                            <child> \
+                              <object class=\"GtkRadioMenuItem\" id=\"prefetch_1\"> \
+                                <property name=\"visible\">True</property> \
+                                <property name=\"can_focus\">False</property> \
+                                <property name=\"label\" translatable=\"yes\">1 Either Side</property> \
+                                <property name=\"use_underline\">True</property> \
+                                <property name=\"draw_as_radio\">True</property> \
+                                <property name=\"group\">prefetch_off</property> \
+                              </object> \
+                            </child> \
+                            <child> \
+                              <object class=\"GtkRadioMenuItem\" id=\"prefetch_2\"> \
+                                <property name=\"visible\">True</property> \
+                                <property name=\"can_focus\">False</property> \
+                                <property name=\"label\" translatable=\"yes\">2 Either Side</property> \
+                                <property name=\"use_underline\">True</property> \
+                                <property name=\"active\">True</property> \
+                                <property name=\"draw_as_radio\">True</property> \
+                                <property name=\"group\">prefetch_off</property> \
+                              </object> \
+                            </child> \
+                            <child> \
+                              <object class=\"GtkRadioMenuItem\" id=\"prefetch_4\"> \
+                                <property name=\"visible\">True</property> \
+                                <property name=\"can_focus\">False</property> \
+                                <property name=\"label\" translatable=\"yes\">4 Either Side</property> \
+                                <property name=\"use_underline\">True</property> \
+                                <property name=\"draw_as_radio\">True</property> \
+                                <property name=\"group\">prefetch_off</property> \
+                              </object> \
+                            </child> \
+                          </object> \
+                        </child> \
+                      </object> \
+                    </child> \
+                    <child> \
+                      <object class=\"GtkMenuItem\" id=\"cache_size_submenu_entry\"> \
+                        <property name=\"visible\">True</property> \
+                        <property name=\"can_focus\">False</property> \
+                        <property name=\"label\" translatable=\"yes\">Glyph Cache Size</property> \
+                        <property name=\"use_underline\">True</property> \
+                        <child type=\"submenu\"> \
+                          <object class=\"GtkMenu\" id=\"cache_size_submenu\"> \
+                            <property name=\"visible\">True</property> \
+                            <property name=\"can_focus\">False</property> \
+                            <child> \
+                              <object class=\"GtkRadioMenuItem\" id=\"cache_size_8\"> \
+                                <property name=\"visible\">True</property> \
+                                <property name=\"can_focus\">False</property> \
+                                <property name=\"label\" translatable=\"yes\">8 MB</property> \
+                                <property name=\"use_underline\">True</property> \
+                                <property name=\"draw_as_radio\">True</property> \
+                              </object> \
+                            </child> \
+                            <child> \
+                              <object class=\"GtkRadioMenuItem\" id=\"cache_size_32\"> \
+                                <property name=\"visible\">True</property> \
+                                <property name=\"can_focus\">False</property> \
+                                <property name=\"label\" translatable=\"yes\">32 MB</property> \
+                                <property name=\"use_underline\">True</property> \
+                                <property name=\"active\">True</property> \
+                                <property name=\"draw_as_radio\">True</property> \
+                                <property name=\"group\">cache_size_8</property> \
+                              </object> \
+                            </child> \
+                            <child> \
+                              <object class=\"GtkRadioMenuItem\" id=\"cache_size_128\"> \
+                                <property name=\"visible\">True</property> \
+                                <property name=\"can_focus\">False</property> \
+                                <property name=\"label\" translatable=\"yes\">128 MB</property> \
+                                <property name=\"use_underline\">True</property> \
+                                <property name=\"draw_as_radio\">True</property> \
+                                <property name=\"group\">cache_size_8</property> \
+                              </object> \
+                            </child> \
+                          </object> \
+                        </child> \
+                      </object> \
+                    </child> \
+                    <child> \
+                      <object class=\"GtkCheckMenuItem\" id=\"ft_cache_backend\"> \
+                        <property name=\"visible\">True</property> \
+                        <property name=\"can_focus\">False</property> \
+                        <property name=\"label\" translatable=\"yes\">Use Freetype Cache</property> \
+                        <property name=\"use_underline\">True</property> \
+                      </object> \
+                    </child> \
                   </object> \
                 </child> \
               </object> \
@@ -508,6 +623,22 @@ const char* GLADE_STRING = "<?xml version=\"1.0\" encoding=\"UTF-8\"?> \
                         <property name=\"use_underline\">True</property> \
                       </object> \
                     </child> \
+                    <child> \
+                      <object class=\"GtkCheckMenuItem\" id=\"direct_rendering\"> \
+                        <property name=\"visible\">True</property> \
+                        <property name=\"can_focus\">False</property> \
+                        <property name=\"label\" translatable=\"yes\">Render Greyscale Spans Directly</property> \
+                        <property name=\"use_underline\">True</property> \
+                      </object> \
+                    </child> \
+                    <child> \
+                      <object class=\"GtkCheckMenuItem\" id=\"coverage_masking\"> \
+                        <property name=\"visible\">True</property> \
+                        <property name=\"can_focus\">False</property> \
+                        <property name=\"label\" translatable=\"yes\">Composite Greyscale With Cairo Mask</property> \
+                        <property name=\"use_underline\">True</property> \
+                      </object> \
+                    </child> \
                   </object> \
                 </child> \
               </object> \
@@ -538,6 +669,19 @@ const char* GLADE_STRING = "<?xml version=\"1.0\" encoding=\"UTF-8\"?> \
                         <property name=\"label\" translatable=\"yes\">Goto Unicode Char...</property> \
                       </object> \
                     </child> \
+                    <child> \
+                      <object class=\"GtkSeparatorMenuItem\" id=\"tools_sep_1\"> \
+                        <property name=\"visible\">True</property> \
+                        <property name=\"can_focus\">False</property> \
+                      </object> \
+                    </child> \
+                    <child> \
+                      <object class=\"GtkMenuItem\" id=\"show_stats\"> \
+                        <property name=\"visible\">True</property> \
+                        <property name=\"can_focus\">False</property> \
+                        <property name=\"label\" translatable=\"yes\">Render Statistics...</property> \
+                      </object> \
+                    </child> \
                   </object> \
                 </child> \
               </object> \
@@ -560,6 +704,45 @@ const char* GLADE_STRING = "<?xml version=\"1.0\" encoding=\"UTF-8\"?> \
             <property name=\"position\">1</property> \
           </packing> \
         </child> \
+        <child> \
+          <object class=\"GtkHBox\" id=\"open_progress_box\"> \
+            <property name=\"can_focus\">False</property> \
+            <property name=\"no_show_all\">True</property> \
+            <property name=\"border_width\">2</property> \
+            <property name=\"spacing\">4</property> \
+            <child> \
+              <object class=\"GtkProgressBar\" id=\"open_progress_bar\"> \
+                <property name=\"visible\">True</property> \
+                <property name=\"can_focus\">False</property> \
+                <property name=\"text\" translatable=\"yes\">Opening font...</property> \
+              </object> \
+              <packing> \
+                <property name=\"expand\">True</property> \
+                <property name=\"fill\">True</property> \
+                <property name=\"position\">0</property> \
+              </packing> \
+            </child> \
+            <child> \
+              <object class=\"GtkButton\" id=\"open_progress_cancel\"> \
+                <property name=\"label\">gtk-cancel</property> \
+                <property name=\"visible\">True</property> \
+                <property name=\"can_focus\">True</property> \
+                <property name=\"receives_default\">False</property> \
+                <property name=\"use_stock\">True</property> \
+              </object> \
+              <packing> \
+                <property name=\"expand\">False</property> \
+                <property name=\"fill\">False</property> \
+                <property name=\"position\">1</property> \
+              </packing> \
+            </child> \
+          </object> \
+          <packing> \
+            <property name=\"expand\">False</property> \
+            <property name=\"fill\">True</property> \
+            <property name=\"position\">2</property> \
+          </packing> \
+        </child> \
       </object> \
     </child> \
   </object> \
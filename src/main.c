@@ -1,21 +1,177 @@
 #include "glyphviewerglobals.h"
+#include "glyphrasterizer.h"
 #include "utils.h"
 #include "outlineprocessing.h"
 #include "controls.h"
 #include "interface.glade.h"
 
 #include <math.h> /* for M_PI */
+#include <string.h> /* for memset */
 
 
   static void
   _calculate_initial_scale();
 
 
+/* Point markers up to this radius are stamped from pre-rendered sprites */
+#define POINT_SPRITE_MAX_RADIUS 4
+
+/* Subpixel positions per axis the sprites are rendered at */
+#define POINT_SPRITE_PHASES 4
+
+/* Grid cells smaller than this (in pixels) only get every few lines drawn */
+#define GRID_MIN_CELL 4
+
+/* Below this scale the grid lines are hidden, only the origin is drawn */
+#define GRID_HIDE_SCALE 2
+
+/* Larger magnified glyph images aren't kept, cairo scales them when drawn */
+#define MAGNIFIED_MAX_BYTES ( 8 * 1024 * 1024 )
+
+
+  /*
+   * setup_glyph() only notes that the glyph is out of date, the work is done
+   * once the main loop has caught up with the pending events using whatever
+   * the settings are by then. Holding down a key that steps through glyphs
+   * or sizes then only rasterizes the latest state instead of every step.
+   */
+  static struct RenderSchedule
+  {
+    /* Idle source that will pick up the settings, 0 when none pending */
+    guint            idle_id;
+
+    /* Furthest the pipeline has been invalidated back since the idle */
+    /* source last ran                                                */
+    InvalidationLevel level;
+
+    /* When the settings last changed */
+    gint64           requested_time;
+
+    /* Rasterizer serial and change time of the latest request sent */
+    guint            latest_serial;
+    gint64           latest_time;
+
+    /* Serial of the request the glyph on screen was made for */
+    guint            shown_serial;
+
+    /* Idle source that will queue the prefetches, 0 when none pending */
+    guint            prefetch_id;
+
+    /* Reports glyphs that couldn't be rendered, NULL when not shown */
+    GtkWidget       *error_dialog;
+
+    RenderStats      stats;
+  } _schedule;
+
+
+  /*
+   * The drawing is made of layers, each kept in its own offscreen surface so
+   * an expose only has to composite them. A layer is drawn again only when
+   * something it depends on has changed.
+   */
+  typedef enum
+  {
+    /* Background and glyph image */
+    LAYER_GLYPH,
+    LAYER_GRID,
+    LAYER_OUTLINE,
+    LAYER_POINTS,
+
+    NUM_LAYERS
+  } ViewLayer;
+
+
+  /* Everything the layers depend on */
+  typedef struct LayerInputsRec_
+  {
+    /* Holds a reference while stored for a layer so the address can't be */
+    /* reused by another entry                                             */
+    GlyphCacheEntry   *glyph;
+
+    gboolean           show_subpixel_mask;
+    FT_F26Dot6         scale;
+    int                x_origin;
+    int                y_origin;
+    int                width;
+    int                height;
+
+    /* Only compared for the layers that draw with them */
+    ViewerColor        bg_color;
+    ViewerColor        text_color;
+    ViewerColor        grid_color;
+    ViewerColor        outline_color;
+    ViewerColor        on_point_color;
+    ViewerColor        ctrl_point_color;
+    double             point_radius;
+  } LayerInputs;
+
+
+  static struct ViewLayers
+  {
+    cairo_surface_t   *surfaces[NUM_LAYERS];
+
+    /* Surfaces the same size to scroll into, swapped with the above */
+    cairo_surface_t   *spares[NUM_LAYERS];
+
+    /* What each layer was last drawn with, only meaningful with a surface */
+    LayerInputs        inputs[NUM_LAYERS];
+
+    /* Parts of each surface not drawn with those inputs yet, NULL when */
+    /* it's all up to date                                              */
+    GdkRegion         *stale[NUM_LAYERS];
+  } _layers;
+
+
+  /*
+   * Pre-rendered point markers. Each point type has a row of cells, one for
+   * each subpixel position of the centre, so stamping a point is just a
+   * copy of the nearest cell.
+   */
+  static struct PointSprites
+  {
+    /* ARGB32, POINT_SPRITE_PHASES^2 cells per point type side by side */
+    cairo_surface_t   *atlas;
+    cairo_pattern_t   *pattern;
+
+    /* Cell size and where the centre is (for phase 0) inside a cell */
+    int                cell_size;
+    int                centre;
+
+    /* What the atlas was drawn with */
+    double             radius;
+    ViewerColor        colors[2];
+  } _point_sprites;
+
+
+  /*
+   * One cell of the grid, repeated to fill the grid layer instead of adding
+   * a line to the path for every pixel boundary.
+   */
+  static struct GridTile
+  {
+    /* Repeating pattern for a step x step tile, lines on its last column */
+    /* and row                                                            */
+    cairo_pattern_t   *pattern;
+
+    int                step;
+    ViewerColor        color;
+  } _grid_tile;
+
+
   void
-  switch_font( FT_Face face )
+  switch_font( FT_Face face, const char *filename )
   {
+    glyph_rasterizer_set_font( face, filename );
+
+    if( globals.glyph )
+    {
+      glyph_cache_entry_unref( globals.glyph );
+      globals.glyph = 0;
+    }
+
     if( globals.face )
     {
+      glyph_cache_purge_face( globals.face );
       FT_Done_Face( globals.face );
       globals.face = 0;
     }
@@ -126,29 +282,142 @@
   }
 
 
+  /* Does a rectangle (in drawing area pixels) touch the damaged area? */
+  static gboolean
+  _is_damaged( const GdkRectangle  *damage,
+               double               x,
+               double               y,
+               double               width,
+               double               height )
+  {
+    return x < damage->x + damage->width  && x + width > damage->x &&
+           y < damage->y + damage->height && y + height > damage->y;
+  }
+
+
+  /* Is any of the glyph image inside the damaged area? */
+  static gboolean
+  _is_glyph_damaged( const GdkRectangle *damage )
+  {
+    cairo_surface_t *surface = globals.glyph->surface;
+
+    return _is_damaged( damage,
+        globals.x_origin + globals.glyph->bitmap_left * globals.scale,
+        globals.y_origin - globals.glyph->bitmap_top * globals.scale,
+        cairo_image_surface_get_width( surface ) * (double) globals.scale,
+        cairo_image_surface_get_height( surface ) * (double) globals.scale );
+  }
+
+
+  /*
+   * Get the glyph image (or its subpixel mask) scaled up to the current
+   * scale. It's made once per scale and kept with the glyph so drawing is
+   * just a copy. Returns NULL if it would be too big to keep, the caller
+   * then needs to scale it while drawing.
+   */
+  static cairo_surface_t *
+  _get_magnified_surface( cairo_surface_t *surface, gboolean from_mask )
+  {
+    GlyphCacheEntry *glyph = globals.glyph;
+    int scale = globals.scale;
+
+    /* The mask is three columns per pixel, its width is still the glyph's */
+    int width = cairo_image_surface_get_width( glyph->surface ) * scale;
+    int height = cairo_image_surface_get_height( surface ) * scale;
+
+    if( glyph->magnified_surface && glyph->magnified_scale == scale &&
+        !glyph->magnified_mask == !from_mask )
+      return glyph->magnified_surface;
+
+    if( (gsize) width * height *
+        ( cairo_image_surface_get_format( surface ) == CAIRO_FORMAT_A8
+          ? 1 : 4 ) > MAGNIFIED_MAX_BYTES )
+    {
+      /* Don't keep one for a scale that's no longer shown */
+      if( glyph->magnified_surface )
+        glyph_cache_entry_set_magnified_surface( glyph, NULL, 0, FALSE );
+
+      return NULL;
+    }
+
+    glyph_cache_entry_set_magnified_surface( glyph,
+        create_magnified_surface( surface, width, scale ), scale, from_mask );
+
+    return glyph->magnified_surface;
+  }
+
+
+  /*
+   * Draw an image of the glyph at its place on the grid, already magnified
+   * if possible, otherwise scaled up by cairo. A8 surfaces are used as a mask
+   * for the source that's already been set.
+   */
   static void
-  _draw_glyph_bitmap( cairo_t *cr )
+  _draw_glyph_surface( cairo_t          *cr,
+                       cairo_surface_t  *surface,
+                       gboolean          from_mask )
   {
+    cairo_surface_t *magnified = _get_magnified_surface( surface, from_mask );
+    gboolean is_mask = cairo_image_surface_get_format( surface )
+                       == CAIRO_FORMAT_A8;
     cairo_pattern_t *pattern;
 
-    int x_offset = globals.x_origin + globals.face->glyph->bitmap_left * globals.scale;
-    int y_offset = globals.y_origin - globals.face->glyph->bitmap_top * globals.scale;
+    int x_offset = globals.x_origin + globals.glyph->bitmap_left * globals.scale;
+    int y_offset = globals.y_origin - globals.glyph->bitmap_top * globals.scale;
+
+    if( magnified )
+    {
+      if( is_mask )
+        cairo_mask_surface( cr, magnified, x_offset, y_offset );
+      else
+      {
+        cairo_set_source_surface( cr, magnified, x_offset, y_offset );
+        cairo_paint( cr );
+      }
+
+      return;
+    }
 
     /* Transformations need to be set so they can be applied to the source. */
     cairo_translate( cr, x_offset, y_offset );
-    cairo_scale( cr, globals.scale, globals.scale );
+    cairo_scale( cr,
+                 globals.scale * cairo_image_surface_get_width(
+                     globals.glyph->surface ) /
+                 (double) cairo_image_surface_get_width( surface ),
+                 globals.scale );
 
     /* Use a pattern for the source so the scaling method can be set. */
-    pattern = cairo_pattern_create_for_surface( globals.glyph_surface );
+    pattern = cairo_pattern_create_for_surface( surface );
     cairo_pattern_set_filter( pattern, CAIRO_FILTER_NEAREST );
 
-    cairo_set_source( cr, pattern );
-    cairo_paint( cr );
+    if( is_mask )
+      cairo_mask( cr, pattern );
+    else
+    {
+      cairo_set_source( cr, pattern );
+      cairo_paint( cr );
+    }
 
     cairo_pattern_destroy( pattern );
   }
 
 
+  static void
+  _draw_glyph_bitmap( cairo_t *cr )
+  {
+    /* Coverage only glyphs get their color here */
+    if( cairo_image_surface_get_format( globals.glyph->surface )
+        == CAIRO_FORMAT_A8 )
+    {
+      ViewerColor c = globals.text_color;
+
+      cairo_set_source_rgb( cr, c.red, c.green, c.blue );
+    }
+
+    _draw_glyph_surface( cr, globals.glyph->surface, FALSE );
+  }
+
+
   /*
    * Draw the individual subpixels of the glyph image so we can see their
    * intensities instead of a colored pixel.
@@ -158,74 +427,65 @@
   static void
   _draw_glyph_subpixel_mask( cairo_t *cr )
   {
-    cairo_surface_t *surface;
-    cairo_pattern_t *pattern;
-
-    int src_width = cairo_image_surface_get_width( globals.glyph_surface );
-    int src_height = cairo_image_surface_get_height( globals.glyph_surface );
-    int src_stride = cairo_image_surface_get_stride( globals.glyph_surface );
-
-    unsigned char *src_data =
-        cairo_image_surface_get_data( globals.glyph_surface );
+    /* The expanded mask is kept with the glyph so it's only built once. */
+    if( !globals.glyph->mask_surface )
+      glyph_cache_entry_set_mask_surface( globals.glyph,
+          create_subpixel_mask_surface( globals.glyph->surface ) );
 
-    surface = cairo_image_surface_create( CAIRO_FORMAT_RGB24, src_width * 3,
-                                                              src_height );
-
-    unsigned char *dst_data = cairo_image_surface_get_data( surface );
-
-    int dst_stride = cairo_image_surface_get_stride( surface );
-
-    /* Probably unnecessary but just to be safe */
-    cairo_surface_flush( surface );
-
-    for( int row = 0; row < src_height; row++ )
-    {
-      /* Stride is the row size in BYTES */
-      unsigned char *src_row = src_data + row * src_stride;
-      unsigned char *dst_row = dst_data + row * dst_stride;
+    _draw_glyph_surface( cr, globals.glyph->mask_surface, TRUE );
+  }
 
-      for( int px = 0; px < src_width; px++ )
-      {
-        unsigned int *src_px = (unsigned int*) src_row + px;
-        unsigned int *dst_p  = (unsigned int*) dst_row + px * 3;
 
-        unsigned int r = *src_px >> 16 & 0xFF;
-        unsigned int g = *src_px >>  8 & 0xFF;
-        unsigned int b = *src_px >>  0 & 0xFF;
+  /* Make sure the grid tile is for the given line spacing and color. */
+  static void
+  _update_grid_tile( int step, ViewerColor c )
+  {
+    struct GridTile *gt = &_grid_tile;
+    cairo_surface_t *tile;
+    cairo_t *cr;
 
-        dst_p[0] = r << 16 | r << 8 | r;
-        dst_p[1] = g << 16 | g << 8 | g;
-        dst_p[2] = b << 16 | b << 8 | b;
-      }
-    }
+    if( gt->pattern && gt->step == step &&
+        memcmp( &gt->color, &c, sizeof( c ) ) == 0 )
+      return;
 
-    cairo_surface_mark_dirty( surface );
+    if( gt->pattern )
+      cairo_pattern_destroy( gt->pattern );
 
-    /* This almost the same as _draw_glyph_bitmap() at this point */
+    gt->step = step;
+    gt->color = c;
 
-    int x_offset = globals.x_origin + globals.face->glyph->bitmap_left * globals.scale;
-    int y_offset = globals.y_origin - globals.face->glyph->bitmap_top * globals.scale;
+    tile = cairo_image_surface_create( CAIRO_FORMAT_ARGB32, step, step );
+    cr = cairo_create( tile );
 
-    cairo_translate( cr, x_offset, y_offset );
-    cairo_scale( cr, globals.scale / 3.0, globals.scale );
+    /* Filled together so the corner where they cross isn't blended twice */
+    cairo_set_source_rgba( cr, c.red, c.green, c.blue, 0.3 );
+    cairo_rectangle( cr, step - 1, 0, 1, step );
+    cairo_rectangle( cr, 0, step - 1, step - 1, 1 );
+    cairo_fill( cr );
 
-    /* Use a pattern for the source so the scaling method can be set. */
-    pattern = cairo_pattern_create_for_surface( surface );
-    cairo_pattern_set_filter( pattern, CAIRO_FILTER_NEAREST );
+    cairo_destroy( cr );
 
-    cairo_set_source( cr, pattern );
-    cairo_paint( cr );
+    gt->pattern = cairo_pattern_create_for_surface( tile );
+    cairo_pattern_set_extend( gt->pattern, CAIRO_EXTEND_REPEAT );
+    cairo_pattern_set_filter( gt->pattern, CAIRO_FILTER_NEAREST );
 
-    cairo_pattern_destroy( pattern );
-    cairo_surface_destroy( surface );
+    cairo_surface_destroy( tile );
   }
 
 
+  /*
+   * Grid lines fall on the pixel boundaries every scale pixels from the
+   * origin. They're filled from a repeating tile so the cost doesn't depend
+   * on how many there are. When the cells get small only every few lines are
+   * drawn, and below GRID_HIDE_SCALE just the origin lines.
+   */
   static void
-  _draw_grid_lines( cairo_t *cr )
+  _draw_grid_lines( cairo_t *cr, const GdkRectangle *damage )
   {
     GtkAllocation alloc;
-    double x_origin, y_origin, scale;
+    double x_origin, y_origin;
+    double top, bottom, left, right;
+    int scale = (int) globals.scale;
 
     ViewerColor c = globals.grid_color;
 
@@ -233,46 +493,53 @@
     x_origin = globals.x_origin - 0.5;
     y_origin = globals.y_origin - 0.5;
 
-    scale    = globals.scale;
-
     /* Get the size of the area to draw into */
     gtk_widget_get_allocation( globals.drawing_area, &alloc );
 
-    cairo_set_source_rgba( cr, c.red, c.green, c.blue, 0.3 );
-    cairo_set_line_width( cr, 1 );
+    /* Only the damaged area needs filled */
+    left   = MAX( damage->x, 0 );
+    top    = MAX( damage->y, 0 );
+    right  = MIN( damage->x + damage->width, alloc.width );
+    bottom = MIN( damage->y + damage->height, alloc.height );
 
-    for( double x = x_origin - scale; x > 0; x -= scale )
-    {
-      cairo_move_to( cr, x, 0 );
-      cairo_line_to( cr, x, alloc.height );
-    }
+    if( left >= right || top >= bottom )
+      return;
 
-    for( double x = x_origin + scale; x < alloc.width; x += scale )
+    if( scale >= GRID_HIDE_SCALE )
     {
-      cairo_move_to( cr, x, 0 );
-      cairo_line_to( cr, x, alloc.height );
-    }
+      cairo_matrix_t matrix;
+      int step = scale;
 
-    for( double y = y_origin - scale; y > 0; y -= scale )
-    {
-      cairo_move_to( cr, 0, y );
-      cairo_line_to( cr, alloc.width, y );
-    }
+      /* Thin out small cells, keeping the lines that line up with the origin */
+      while( step < GRID_MIN_CELL )
+        step += scale;
 
-    for( double y = y_origin + scale; y < alloc.height; y += scale)
-    {
-      cairo_move_to( cr, 0, y );
-      cairo_line_to( cr, alloc.width, y );
-    }
+      _update_grid_tile( step, c );
 
-    cairo_stroke( cr );
+      /* The tile's corner goes on the origin */
+      cairo_matrix_init_translate( &matrix, -globals.x_origin,
+                                            -globals.y_origin );
+      cairo_pattern_set_matrix( _grid_tile.pattern, &matrix );
+
+      cairo_set_source( cr, _grid_tile.pattern );
+      cairo_rectangle( cr, left, top, right - left, bottom - top );
+      cairo_fill( cr );
+
+      /* The origin lines have their own color, don't blend over the tile */
+      cairo_set_operator( cr, CAIRO_OPERATOR_CLEAR );
+      cairo_rectangle( cr, x_origin - 0.5, top, 1, bottom - top );
+      cairo_rectangle( cr, left, y_origin - 0.5, right - left, 1 );
+      cairo_fill( cr );
+      cairo_set_operator( cr, CAIRO_OPERATOR_OVER );
+    }
 
     /* Origin lines are a seperate color. */
     cairo_set_source_rgba( cr, c.red, c.green, c.blue, 0.8 );
-    cairo_move_to( cr, x_origin, 0 );
-    cairo_line_to( cr, x_origin, alloc.height );
-    cairo_move_to( cr, 0, y_origin );
-    cairo_line_to( cr, alloc.width, y_origin );
+    cairo_set_line_width( cr, 1 );
+    cairo_move_to( cr, x_origin, top );
+    cairo_line_to( cr, x_origin, bottom );
+    cairo_move_to( cr, left, y_origin );
+    cairo_line_to( cr, right, y_origin );
 
     cairo_stroke( cr );
   }
@@ -288,9 +555,11 @@
     cairo_translate( cr, globals.x_origin, globals.y_origin );
     cairo_scale( cr, globals.scale, -globals.scale );
 
+    /* Segments well clear of the clip (allowing for the line joins) are */
+    /* left out, breaking the path up if it leaves and comes back       */
     cairo_new_path( cr );
-    process_outline( cr, &globals.face->glyph->outline );
-    cairo_close_path( cr );
+    if( !append_outline_path_clipped( cr, globals.glyph->outline_path, 8 ) )
+      cairo_close_path( cr );
 
     /* Reset transformation matrix so the stroke width won't be scaled. */
     cairo_identity_matrix( cr );
@@ -299,28 +568,161 @@
   }
 
 
+  /* Make sure the sprite atlas matches the point radius and colors. */
   static void
-  _draw_points( cairo_t *cr )
+  _update_point_sprites( double radius, const ViewerColor colors[2] )
   {
-    FT_Outline *outline = &globals.face->glyph->outline;
+    struct PointSprites *ps = &_point_sprites;
+    cairo_t *cr;
+
+    if( ps->atlas && ps->radius == radius &&
+        memcmp( ps->colors, colors, sizeof( ps->colors ) ) == 0 )
+      return;
+
+    if( ps->atlas )
+    {
+      cairo_pattern_destroy( ps->pattern );
+      cairo_surface_destroy( ps->atlas );
+    }
+
+    ps->radius = radius;
+    memcpy( ps->colors, colors, sizeof( ps->colors ) );
+
+    /* Room for the dot, a pixel of phase offset and a pixel of antialiasing */
+    ps->centre = (int) ceil( radius ) + 1;
+    ps->cell_size = ps->centre * 2 + 1;
+
+    ps->atlas = cairo_image_surface_create( CAIRO_FORMAT_ARGB32,
+        ps->cell_size * POINT_SPRITE_PHASES * POINT_SPRITE_PHASES * 2,
+        ps->cell_size );
 
-    ViewerColor c_on = globals.on_point_color;
-    ViewerColor c_ctl = globals.ctrl_point_color;
+    cr = cairo_create( ps->atlas );
 
-    for( int i = 0; i < outline->n_points; i++ )
+    for( int type = 0; type < 2; type++ )
     {
-      if( outline->tags[i] & 1 ) /* Point on curve */
-        cairo_set_source_rgb( cr, c_on.red, c_on.green, c_on.blue );
+      ViewerColor c = colors[type];
 
-      else /* Control point */
-        cairo_set_source_rgb( cr, c_ctl.red, c_ctl.green, c_ctl.blue );
+      cairo_set_source_rgb( cr, c.red, c.green, c.blue );
+
+      for( int phase = 0; phase < POINT_SPRITE_PHASES * POINT_SPRITE_PHASES;
+           phase++ )
+      {
+        int cell = type * POINT_SPRITE_PHASES * POINT_SPRITE_PHASES + phase;
+        double fx = (double)( phase % POINT_SPRITE_PHASES ) /
+                    POINT_SPRITE_PHASES;
+        double fy = (double)( phase / POINT_SPRITE_PHASES ) /
+                    POINT_SPRITE_PHASES;
+
+        cairo_new_sub_path( cr );
+        cairo_arc( cr, cell * ps->cell_size + ps->centre + fx,
+                       ps->centre + fy,
+                       radius, 0, 2 * M_PI );
+      }
 
-      FT_Vector *p = outline->points + i;
-      cairo_arc( cr, globals.x_origin + p->x * globals.scale / 64.0,
-                     globals.y_origin - p->y * globals.scale / 64.0,
-                     2, 0, 2 * M_PI );
       cairo_fill( cr );
     }
+
+    cairo_destroy( cr );
+
+    /* Only ever moved by whole pixels */
+    ps->pattern = cairo_pattern_create_for_surface( ps->atlas );
+    cairo_pattern_set_filter( ps->pattern, CAIRO_FILTER_NEAREST );
+  }
+
+
+  /* Copy the sprite cell for a point centred at x, y. */
+  static void
+  _stamp_point( cairo_t *cr, int type, double x, double y )
+  {
+    struct PointSprites *ps = &_point_sprites;
+    cairo_matrix_t matrix;
+    double sx, sy;
+    int px, py, cell;
+
+    /* Split into whole pixels and the nearest subpixel phase */
+    sx = floor( x * POINT_SPRITE_PHASES + 0.5 );
+    sy = floor( y * POINT_SPRITE_PHASES + 0.5 );
+
+    px = (int) floor( sx / POINT_SPRITE_PHASES );
+    py = (int) floor( sy / POINT_SPRITE_PHASES );
+
+    cell = type * POINT_SPRITE_PHASES * POINT_SPRITE_PHASES +
+           (int)( sy - py * POINT_SPRITE_PHASES ) * POINT_SPRITE_PHASES +
+           (int)( sx - px * POINT_SPRITE_PHASES );
+
+    /* Top left of the cell on the target */
+    px -= ps->centre;
+    py -= ps->centre;
+
+    cairo_matrix_init_translate( &matrix, cell * ps->cell_size - px, -py );
+    cairo_pattern_set_matrix( ps->pattern, &matrix );
+
+    cairo_set_source( cr, ps->pattern );
+    cairo_rectangle( cr, px, py, ps->cell_size, ps->cell_size );
+    cairo_fill( cr );
+  }
+
+
+  /*
+   * Draw the outline points, control points first with the points on the
+   * curve over them. Small markers are stamped from sprites, larger ones are
+   * added to one path per type and filled once.
+   */
+  static void
+  _draw_points( cairo_t *cr, const GdkRectangle *damage )
+  {
+    FT_Outline *outline = &globals.glyph->outline;
+    double radius = globals.point_radius;
+    double reach = radius + 1;
+
+    /* Indexed by the on curve tag bit */
+    ViewerColor colors[2] = { globals.ctrl_point_color,
+                              globals.on_point_color };
+
+    gboolean use_sprites = radius <= POINT_SPRITE_MAX_RADIUS;
+
+    if( use_sprites )
+      _update_point_sprites( radius, colors );
+
+    for( int type = 0; type < 2; type++ )
+    {
+      ViewerColor c = colors[type];
+
+      cairo_new_path( cr );
+
+      for( int i = 0; i < outline->n_points; i++ )
+      {
+        FT_Vector *p = outline->points + i;
+        double x, y;
+
+        if( ( outline->tags[i] & 1 ) != type )
+          continue;
+
+        x = globals.x_origin + p->x * globals.scale / 64.0;
+        y = globals.y_origin - p->y * globals.scale / 64.0;
+
+        /* Leave out points that don't touch the damage */
+        if( !_is_damaged( damage, x - reach, y - reach,
+                          reach * 2, reach * 2 ) )
+          continue;
+
+        if( use_sprites )
+        {
+          _stamp_point( cr, type, x, y );
+        }
+        else
+        {
+          cairo_new_sub_path( cr );
+          cairo_arc( cr, x, y, radius, 0, 2 * M_PI );
+        }
+      }
+
+      if( !use_sprites )
+      {
+        cairo_set_source_rgb( cr, c.red, c.green, c.blue );
+        cairo_fill( cr );
+      }
+    }
   }
 
 
@@ -334,32 +736,358 @@
   }
 
 
+  static gboolean
+  _is_layer_shown( ViewLayer layer )
+  {
+    switch( layer )
+    {
+      case LAYER_GLYPH:
+        return TRUE;
+
+      case LAYER_GRID:
+        return globals.glyph && _test_setting_flags( &globals.draw_grid );
+
+      case LAYER_OUTLINE:
+      case LAYER_POINTS:
+        return globals.glyph && _test_setting_flags( &globals.draw_outline );
+
+      default:
+        return FALSE;
+    }
+  }
+
+
+  static gboolean
+  _is_same_color( const ViewerColor *a, const ViewerColor *b )
+  {
+    return memcmp( a, b, sizeof( *a ) ) == 0;
+  }
+
+
+  /*
+   * Was the layer's surface last drawn with the inputs? Parts of it may still
+   * be stale, they're drawn when they're exposed.
+   */
+  static gboolean
+  _is_layer_current( ViewLayer layer, const LayerInputs *inputs )
+  {
+    const LayerInputs *drawn = &_layers.inputs[layer];
+
+    if( !_layers.surfaces[layer]                 ||
+        drawn->width    != inputs->width         ||
+        drawn->height   != inputs->height        ||
+        drawn->scale    != inputs->scale         ||
+        drawn->x_origin != inputs->x_origin      ||
+        drawn->y_origin != inputs->y_origin )
+      return FALSE;
+
+    switch( layer )
+    {
+      case LAYER_GLYPH:
+        if( drawn->show_subpixel_mask != inputs->show_subpixel_mask ||
+            !_is_same_color( &drawn->bg_color, &inputs->bg_color ) )
+          return FALSE;
+
+        /* Coverage only glyphs get the text color when drawn */
+        if( inputs->glyph && inputs->glyph->key.raster.coverage_only &&
+            !_is_same_color( &drawn->text_color, &inputs->text_color ) )
+          return FALSE;
+        break;
+
+      case LAYER_GRID:
+        /* The grid is the same whatever glyph is shown */
+        return _is_same_color( &drawn->grid_color, &inputs->grid_color );
+
+      case LAYER_OUTLINE:
+        if( !_is_same_color( &drawn->outline_color, &inputs->outline_color ) )
+          return FALSE;
+        break;
+
+      case LAYER_POINTS:
+        if( !_is_same_color( &drawn->on_point_color,
+                             &inputs->on_point_color )         ||
+            !_is_same_color( &drawn->ctrl_point_color,
+                             &inputs->ctrl_point_color )       ||
+            drawn->point_radius != inputs->point_radius )
+          return FALSE;
+        break;
+
+      default:
+        break;
+    }
+
+    return drawn->glyph == inputs->glyph;
+  }
+
+
+  /* Draw the part of a layer inside the damaged area. */
+  static void
+  _draw_layer_contents( ViewLayer layer,
+                        cairo_t *cr,
+                        const GdkRectangle *damage )
+  {
+    switch( layer )
+    {
+      case LAYER_GLYPH:
+        RESTORE_AFTER( cr, _clear_background( cr ) );
+
+        if( !globals.glyph || !_is_glyph_damaged( damage ) )
+          break;
+
+        if( !globals.show_subpixel_mask )
+          RESTORE_AFTER( cr, _draw_glyph_bitmap( cr ) );
+        else
+          RESTORE_AFTER( cr, _draw_glyph_subpixel_mask( cr ) );
+        break;
+
+      case LAYER_GRID:
+        RESTORE_AFTER( cr, _draw_grid_lines( cr, damage ) );
+        break;
+
+      case LAYER_OUTLINE:
+        RESTORE_AFTER( cr, _draw_outline( cr ) );
+        break;
+
+      case LAYER_POINTS:
+        RESTORE_AFTER( cr, _draw_points( cr, damage ) );
+        break;
+
+      default:
+        break;
+    }
+  }
+
+
+  static cairo_surface_t *
+  _create_layer_surface( ViewLayer layer,
+                         cairo_surface_t *target,
+                         const LayerInputs *inputs )
+  {
+    /* The glyph layer is opaque, the others go over it */
+    return cairo_surface_create_similar( target,
+                                         layer == LAYER_GLYPH
+                                         ? CAIRO_CONTENT_COLOR
+                                         : CAIRO_CONTENT_COLOR_ALPHA,
+                                         inputs->width,
+                                         inputs->height );
+  }
+
+
+  /*
+   * Bring the damaged part of a layer up to date with the inputs. When the
+   * inputs have changed the whole surface (created again if the size changed)
+   * goes stale, but only the parts of it that are exposed get drawn. The rest
+   * waits for its own expose, so the grid, outline and points are still only
+   * drawn where they're damaged.
+   */
+  static void
+  _update_layer( ViewLayer           layer,
+                 cairo_t            *window_cr,
+                 const LayerInputs  *inputs,
+                 const GdkRegion    *damage )
+  {
+    LayerInputs *drawn = &_layers.inputs[layer];
+    GdkRectangle all = { 0, 0, inputs->width, inputs->height };
+    GdkRectangle *rects;
+    GdkRegion *missing;
+    int num_rects;
+
+    if( !_is_layer_current( layer, inputs ) )
+    {
+      if( _layers.surfaces[layer] && ( drawn->width != inputs->width ||
+                                       drawn->height != inputs->height ) )
+      {
+        cairo_surface_destroy( _layers.surfaces[layer] );
+        _layers.surfaces[layer] = NULL;
+
+        if( _layers.spares[layer] )
+          cairo_surface_destroy( _layers.spares[layer] );
+        _layers.spares[layer] = NULL;
+      }
+
+      if( !_layers.surfaces[layer] )
+        _layers.surfaces[layer] = _create_layer_surface(
+            layer, cairo_get_target( window_cr ), inputs );
+
+      if( inputs->glyph )
+        glyph_cache_entry_ref( inputs->glyph );
+
+      if( drawn->glyph )
+        glyph_cache_entry_unref( drawn->glyph );
+
+      *drawn = *inputs;
+
+      if( _layers.stale[layer] )
+        gdk_region_destroy( _layers.stale[layer] );
+      _layers.stale[layer] = gdk_region_rectangle( &all );
+    }
+
+    if( !_layers.stale[layer] )
+      return;
+
+    missing = gdk_region_copy( damage );
+    gdk_region_intersect( missing, _layers.stale[layer] );
+
+    gdk_region_get_rectangles( missing, &rects, &num_rects );
+
+    for( int i = 0; i < num_rects; i++ )
+    {
+      cairo_t *cr = cairo_create( _layers.surfaces[layer] );
+
+      gdk_cairo_rectangle( cr, &rects[i] );
+      cairo_clip( cr );
+
+      if( layer != LAYER_GLYPH )
+      {
+        cairo_set_operator( cr, CAIRO_OPERATOR_CLEAR );
+        cairo_paint( cr );
+        cairo_set_operator( cr, CAIRO_OPERATOR_OVER );
+      }
+
+      _draw_layer_contents( layer, cr, &rects[i] );
+
+      cairo_destroy( cr );
+    }
+
+    g_free( rects );
+
+    gdk_region_subtract( _layers.stale[layer], missing );
+    gdk_region_destroy( missing );
+
+    if( gdk_region_empty( _layers.stale[layer] ) )
+    {
+      gdk_region_destroy( _layers.stale[layer] );
+      _layers.stale[layer] = NULL;
+    }
+  }
+
+
+  /*
+   * Move a layer's contents by the change in origin and draw just the strips
+   * uncovered along the edges. The inputs are the new ones, the layer must be
+   * current apart from the origin. Any stale parts move with the contents.
+   */
+  static void
+  _scroll_layer( ViewLayer layer, int dx, int dy, const LayerInputs *inputs )
+  {
+    cairo_surface_t *old = _layers.surfaces[layer];
+    cairo_surface_t *surface = _layers.spares[layer];
+    GdkRectangle strips[2];
+    int num_strips = 0;
+    int width = inputs->width;
+    int height = inputs->height;
+    cairo_t *cr;
+
+    if( !surface )
+      surface = _create_layer_surface( layer, old, inputs );
+
+    /* Source clears whatever the old contents don't cover */
+    cr = cairo_create( surface );
+    cairo_set_operator( cr, CAIRO_OPERATOR_SOURCE );
+    cairo_set_source_surface( cr, old, dx, dy );
+    cairo_paint( cr );
+    cairo_destroy( cr );
+
+    if( dx != 0 )
+      strips[num_strips++] = (GdkRectangle){ dx > 0 ? 0 : width + dx, 0,
+                                             ABS( dx ), height };
+
+    /* Leave out the corner already in the first strip, overlays drawn */
+    /* twice there would come out darker                               */
+    if( dy != 0 )
+      strips[num_strips++] = (GdkRectangle){ dx > 0 ? dx : 0,
+                                             dy > 0 ? 0 : height + dy,
+                                             width - ABS( dx ),
+                                             ABS( dy ) };
+
+    for( int i = 0; i < num_strips; i++ )
+    {
+      cr = cairo_create( surface );
+
+      gdk_cairo_rectangle( cr, &strips[i] );
+      cairo_clip( cr );
+
+      _draw_layer_contents( layer, cr, &strips[i] );
+
+      cairo_destroy( cr );
+    }
+
+    _layers.spares[layer] = old;
+    _layers.surfaces[layer] = surface;
+
+    _layers.inputs[layer].x_origin = inputs->x_origin;
+    _layers.inputs[layer].y_origin = inputs->y_origin;
+
+    if( _layers.stale[layer] )
+    {
+      GdkRectangle all = { 0, 0, width, height };
+      GdkRegion *visible = gdk_region_rectangle( &all );
+
+      gdk_region_offset( _layers.stale[layer], dx, dy );
+      gdk_region_intersect( _layers.stale[layer], visible );
+      gdk_region_destroy( visible );
+
+      if( gdk_region_empty( _layers.stale[layer] ) )
+      {
+        gdk_region_destroy( _layers.stale[layer] );
+        _layers.stale[layer] = NULL;
+      }
+    }
+  }
+
+
+  static void
+  _get_layer_inputs( LayerInputs *inputs )
+  {
+    GtkAllocation alloc;
+
+    gtk_widget_get_allocation( globals.drawing_area, &alloc );
+
+    inputs->glyph              = globals.glyph;
+    inputs->show_subpixel_mask = globals.show_subpixel_mask;
+    inputs->scale              = globals.scale;
+    inputs->x_origin           = globals.x_origin;
+    inputs->y_origin           = globals.y_origin;
+    inputs->width              = alloc.width;
+    inputs->height             = alloc.height;
+
+    inputs->bg_color           = globals.bg_color;
+    inputs->text_color         = globals.text_color;
+    inputs->grid_color         = globals.grid_color;
+    inputs->outline_color      = globals.outline_color;
+    inputs->on_point_color     = globals.on_point_color;
+    inputs->ctrl_point_color   = globals.ctrl_point_color;
+    inputs->point_radius       = globals.point_radius;
+  }
+
+
   static gboolean
   _on_expose_event( GtkWidget *widget,
                    GdkEventExpose *event,
                    gpointer data )
   {
     cairo_t *cr;
+    LayerInputs inputs;
+
+    _get_layer_inputs( &inputs );
 
     cr = gdk_cairo_create( widget->window );
 
-    RESTORE_AFTER( cr, _clear_background( cr ) );
+    /* Only the damaged region needs repainted */
+    gdk_cairo_region( cr, event->region );
+    cairo_clip( cr );
 
-    if( globals.face )
+    /* Hidden layers are left alone and drawn when they're next shown, */
+    /* so toggling the grid or outline is just a recomposite           */
+    for( int layer = 0; layer < NUM_LAYERS; layer++ )
     {
-      if( !globals.show_subpixel_mask )
-        RESTORE_AFTER( cr, _draw_glyph_bitmap( cr ) );
-      else
-        RESTORE_AFTER( cr, _draw_glyph_subpixel_mask( cr ) );
+      if( !_is_layer_shown( layer ) )
+        continue;
 
-      if( _test_setting_flags( &globals.draw_grid ) )
-        RESTORE_AFTER( cr, _draw_grid_lines( cr ) );
+      _update_layer( layer, cr, &inputs, event->region );
 
-      if( _test_setting_flags( &globals.draw_outline ) )
-      {
-        RESTORE_AFTER( cr, _draw_outline( cr ) );
-        RESTORE_AFTER( cr, _draw_points( cr ) );
-      }
+      cairo_set_source_surface( cr, _layers.surfaces[layer], 0, 0 );
+      cairo_paint( cr );
     }
 
     cairo_destroy( cr );
@@ -368,6 +1096,53 @@
   }
 
 
+  /*
+   * Move the glyph origin. Rather than repainting everything the window and
+   * the cached layers are scrolled and only the strips uncovered at the edges
+   * are drawn.
+   */
+  void
+  pan_drawing_area( int x_origin, int y_origin )
+  {
+    LayerInputs inputs;
+    gboolean scroll[NUM_LAYERS];
+    int dx = x_origin - globals.x_origin;
+    int dy = y_origin - globals.y_origin;
+
+    if( dx == 0 && dy == 0 )
+      return;
+
+    _get_layer_inputs( &inputs );
+
+    /* Moved further than the window, everything needs drawn anyway */
+    if( ABS( dx ) >= inputs.width || ABS( dy ) >= inputs.height )
+    {
+      globals.x_origin = x_origin;
+      globals.y_origin = y_origin;
+      invalidate_drawing_area();
+      return;
+    }
+
+    /* Layers out of date for other reasons get redrawn in full on expose */
+    for( int layer = 0; layer < NUM_LAYERS; layer++ )
+      scroll[layer] = _is_layer_shown( layer ) &&
+                      _is_layer_current( layer, &inputs );
+
+    /* The strips are drawn at the new origin */
+    globals.x_origin = inputs.x_origin = x_origin;
+    globals.y_origin = inputs.y_origin = y_origin;
+
+    for( int layer = 0; layer < NUM_LAYERS; layer++ )
+    {
+      if( scroll[layer] )
+        _scroll_layer( layer, dx, dy, &inputs );
+    }
+
+    /* Copies what's on screen and invalidates the uncovered strips */
+    gdk_window_scroll( gtk_widget_get_window( globals.drawing_area ), dx, dy );
+  }
+
+
   void
   invalidate_drawing_area()
   {
@@ -406,70 +1181,342 @@
   }
 
 
-  void
-  setup_glyph()
+  /* Fill in the cache key for the current glyph settings. */
+  static void
+  _get_glyph_cache_key( GlyphCacheKey *key )
+  {
+    GlyphRasterKey *raster = &key->raster;
+    GlyphCompositeKey *composite = &key->composite;
+
+    ViewerColor fg = (ViewerColor){0, 0, 0};
+    ViewerColor bg = (ViewerColor){1, 1, 1};
+
+    /* The subpixel mask is always drawn black on white */
+    if( !globals.show_subpixel_mask )
+    {
+      fg = globals.text_color;
+      bg = globals.bg_color;
+    }
+
+    memset( key, 0, sizeof( *key ) );
+
+    raster->face            = globals.face;
+    raster->glyph_index     = globals.glyph_index;
+    raster->text_size       = globals.text_size;
+    raster->resolution      = globals.resolution;
+    raster->hinting_mode    = globals.hinting_mode;
+    raster->force_autohint  = globals.force_autohint;
+    raster->lcd_rendering   = globals.lcd_rendering;
+    raster->lcd_filter      = globals.lcd_filter;
+
+    /* Cairo can only do the simple blend with a greyscale mask */
+    raster->coverage_only   = globals.coverage_masking    &&
+                              !globals.lcd_rendering      &&
+                              !globals.linear_blending    &&
+                              !globals.show_subpixel_mask;
+
+    /* Direct rendering only does greyscale */
+    raster->direct_rendering = globals.direct_rendering &&
+                               !globals.lcd_rendering   &&
+                               !raster->coverage_only;
+
+    /* Colors are applied when drawing, leave the composite key clear so */
+    /* color changes find the same entry                                 */
+    if( raster->coverage_only )
+      return;
+
+    composite->linear_blending = globals.linear_blending;
+
+    /* Gamma only has an effect on linear blending */
+    composite->gamma = globals.linear_blending ? globals.gamma : 0;
+    composite->gamma_linear_bits = globals.linear_blending
+                                   ? globals.gamma_linear_bits : 0;
+
+    composite->fg[0] = fg.red;
+    composite->fg[1] = fg.green;
+    composite->fg[2] = fg.blue;
+    composite->bg[0] = bg.red;
+    composite->bg[1] = bg.green;
+    composite->bg[2] = bg.blue;
+  }
+
+
+  static void
+  _show_glyph( GlyphCacheEntry *entry )
   {
-    if( globals.glyph_surface )
+    if( globals.glyph )
+      glyph_cache_entry_unref( globals.glyph );
+
+    globals.glyph = glyph_cache_entry_ref( entry );
+
+    invalidate_drawing_area();
+  }
+
+
+  /* Time from the settings changing to the glyph for them being shown. */
+  static void
+  _record_latency( gint64 requested_time )
+  {
+    RenderStats *stats = &_schedule.stats;
+    gint64 latency = g_get_monotonic_time() - requested_time;
+
+    stats->shown++;
+    stats->last_latency = latency;
+    stats->total_latency += latency;
+
+    if( latency > stats->max_latency )
+      stats->max_latency = latency;
+
+    if( latency > RENDER_FRAME_TIME )
+      stats->over_frame++;
+  }
+
+
+  /*
+   * Queue the states the user is likely to step to next: the neighbouring
+   * glyphs (nearest first), a half point either side and the other hinting
+   * modes. The rasterizer only works on them when nothing else is waiting.
+   */
+  static gboolean
+  _prefetch_neighbours( gpointer data )
+  {
+    GlyphCacheKey base, key;
+    int depth = (int) globals.prefetch_depth;
+
+    _schedule.prefetch_id = 0;
+
+    /* The old neighbourhood isn't likely anymore */
+    glyph_rasterizer_cancel_prefetch();
+
+    if( !globals.face || depth == 0 )
+      return FALSE;
+
+    _get_glyph_cache_key( &base );
+
+    for( int i = 1; i <= depth; i++ )
     {
-      cairo_surface_destroy( globals.glyph_surface );
-      globals.glyph_surface = 0;
+      key = base;
+
+      if( base.raster.glyph_index + i < (FT_UInt) globals.face->num_glyphs )
+      {
+        key.raster.glyph_index = base.raster.glyph_index + i;
+        glyph_rasterizer_prefetch( &key );
+      }
+
+      if( base.raster.glyph_index >= (FT_UInt) i )
+      {
+        key.raster.glyph_index = base.raster.glyph_index - i;
+        glyph_rasterizer_prefetch( &key );
+      }
     }
 
+    key = base;
 
-    FT_Int32 load_flags = FT_LOAD_DEFAULT | FT_LOAD_NO_BITMAP;
+    /* Same limits as the font size menu items */
+    if( base.raster.text_size < 100 )
+    {
+      key.raster.text_size = base.raster.text_size + 1;
+      glyph_rasterizer_prefetch( &key );
+    }
 
-    if( globals.hinting_mode == HINTING_MODE_NONE )
-      load_flags |= FT_LOAD_NO_HINTING;
+    if( base.raster.text_size > 2 )
+    {
+      key.raster.text_size = base.raster.text_size - 1;
+      glyph_rasterizer_prefetch( &key );
+    }
 
-    else if( globals.hinting_mode == HINTING_MODE_LIGHT )
-      load_flags |= FT_LOAD_TARGET_LIGHT;
+    key = base;
 
-    else if( globals.hinting_mode == HINTING_MODE_NORMAL )
-      load_flags |= globals.lcd_rendering ? FT_LOAD_TARGET_LCD 
-                                          : FT_LOAD_TARGET_NORMAL;
+    for( int mode = HINTING_MODE_NONE; mode <= HINTING_MODE_NORMAL; mode++ )
+    {
+      if( mode == base.raster.hinting_mode )
+        continue;
 
-    if( globals.hinting_mode != HINTING_MODE_NONE && globals.force_autohint )
-      load_flags |= FT_LOAD_FORCE_AUTOHINT;
+      key.raster.hinting_mode = mode;
+      glyph_rasterizer_prefetch( &key );
+    }
 
+    return FALSE;
+  }
 
-    if( FT_Load_Glyph( globals.face, globals.glyph_index, load_flags ) )
-      panic( "Couldn't load glyph index: %d", globals.glyph_index );
 
-    if (globals.face->glyph->format != FT_GLYPH_FORMAT_OUTLINE)
-      panic( "Glyph format isn't an outline, format %d",
-             globals.face->glyph->format );
+  /* Prefetch around the glyph on screen once the main loop is idle. */
+  static void
+  _schedule_prefetch()
+  {
+    if( !_schedule.prefetch_id )
+      _schedule.prefetch_id = g_idle_add( _prefetch_neighbours, NULL );
+  }
 
 
-    FT_Render_Mode render_mode = globals.lcd_rendering ? FT_RENDER_MODE_LCD
-                                                       : FT_RENDER_MODE_NORMAL;
+  /*
+   * Tell the user a glyph couldn't be rendered without stopping them, if the
+   * message is already up it's just updated.
+   */
+  static void
+  _show_render_error( FT_UInt glyph_index, FT_Error error )
+  {
+    gchar *msg = g_strdup_printf( "Couldn't render glyph %u: "
+                                  "Freetype error 0x%02X",
+                                  glyph_index, error );
 
-    if( FT_Render_Glyph( globals.face->glyph, render_mode ) )
-      panic( "Couldn't render glyph" );
+    if( _schedule.error_dialog )
+      g_object_set( _schedule.error_dialog, "text", msg, NULL );
+    else
+    {
+      _schedule.error_dialog = gtk_message_dialog_new(
+                                   GTK_WINDOW( globals.window ),
+                                   GTK_DIALOG_DESTROY_WITH_PARENT,
+                                   GTK_MESSAGE_ERROR,
+                                   GTK_BUTTONS_CLOSE,
+                                   "%s", msg );
+
+      g_signal_connect_swapped( _schedule.error_dialog, "response",
+                                G_CALLBACK( gtk_widget_destroy ),
+                                _schedule.error_dialog );
+      g_signal_connect( _schedule.error_dialog, "destroy",
+                        G_CALLBACK( gtk_widget_destroyed ),
+                        &_schedule.error_dialog );
+
+      gtk_widget_show( _schedule.error_dialog );
+    }
 
-    globals.glyph_surface =
-        create_surface_for_ft_bitmap_dimensions( 
-            &globals.face->glyph->bitmap );
+    g_free( msg );
+  }
 
-    cairo_t *cr = cairo_create( globals.glyph_surface );
 
-    ViewerColor bg = (ViewerColor){1, 1, 1};
-    if( !globals.show_subpixel_mask )
-      bg = globals.bg_color;
+  static void
+  _on_glyph_rasterized( GlyphCacheEntry  *entry,
+                        FT_Error          error,
+                        guint             serial,
+                        gpointer          user_data )
+  {
+    /* Don't step back to an older request that finished late, but do show */
+    /* newer ones even if they've been superseded so scrubbing keeps moving */
+    if( (gint)( serial - _schedule.shown_serial ) <= 0 )
+      return;
 
-    cairo_set_source_rgb( cr, bg.red, bg.green, bg.blue );
-    cairo_paint( cr );
-    cairo_destroy( cr );
+    _schedule.shown_serial = serial;
 
-    ViewerColor fg = (ViewerColor){0, 0, 0};
-    if( !globals.show_subpixel_mask )
-      fg = globals.text_color;
+    /* The glyph already on screen stays there */
+    if( !entry )
+    {
+      if( serial == _schedule.latest_serial )
+        _show_render_error( globals.glyph_index, error );
 
-    blend_glyph_to_surface( &globals.face->glyph->bitmap,
-                            globals.glyph_surface,
-                            fg.red, fg.green, fg.blue,
-                            globals.linear_blending );
+      return;
+    }
 
-    invalidate_drawing_area();
+    _show_glyph( entry );
+
+    if( serial == _schedule.latest_serial )
+    {
+      _record_latency( _schedule.latest_time );
+      _schedule_prefetch();
+    }
+  }
+
+
+  static gboolean
+  _run_schedule( gpointer data )
+  {
+    GlyphCacheKey key;
+    GlyphCacheEntry *entry;
+    InvalidationLevel level = _schedule.level;
+
+    _schedule.idle_id = 0;
+    _schedule.level = INVALIDATE_VIEW;
+
+    if( !globals.face )
+      return FALSE;
+
+    _get_glyph_cache_key( &key );
+
+    entry = glyph_cache_lookup( &key );
+
+    if( entry )
+    {
+      /* Whatever was being rasterized isn't wanted anymore */
+      _schedule.latest_serial = glyph_rasterizer_cancel();
+      _schedule.shown_serial = _schedule.latest_serial;
+
+      _show_glyph( entry );
+      glyph_cache_entry_unref( entry );
+
+      _record_latency( _schedule.requested_time );
+      _schedule_prefetch();
+    }
+    else
+    {
+      /* The current glyph stays on screen until the new one is ready, */
+      /* a composite change only needs the last coverage re-blended    */
+      _schedule.latest_serial = glyph_rasterizer_request(
+                                    &key,
+                                    level == INVALIDATE_COMPOSITE,
+                                    _on_glyph_rasterized,
+                                    NULL );
+      _schedule.latest_time = _schedule.requested_time;
+    }
+
+    return FALSE;
+  }
+
+
+  /*
+   * Note the glyph is out of date from the given stage of the pipeline on,
+   * the work is done once the pending events have been handled.
+   */
+  static void
+  _schedule_glyph( InvalidationLevel level )
+  {
+    _schedule.stats.requests++;
+    _schedule.requested_time = g_get_monotonic_time();
+    _schedule.level = MAX( _schedule.level, level );
+
+    /* Runs after any events already queued, which can change it again */
+    if( !_schedule.idle_id )
+      _schedule.idle_id = g_idle_add_full( G_PRIORITY_HIGH_IDLE,
+                                           _run_schedule,
+                                           NULL,
+                                           NULL );
+  }
+
+
+  void
+  setup_glyph()
+  {
+    _schedule_glyph( INVALIDATE_RASTER );
+  }
+
+
+  void
+  get_render_stats( RenderStats *stats )
+  {
+    *stats = _schedule.stats;
+  }
+
+
+  /*
+   * Bring the display up to date after a setting changed. The level says which
+   * stage of the pipeline is affected; everything after it is redone too.
+   */
+  void
+  invalidate_glyph( InvalidationLevel level )
+  {
+    if( !globals.face )
+      return;
+
+    switch( level )
+    {
+      case INVALIDATE_RASTER:
+      case INVALIDATE_COMPOSITE:
+        _schedule_glyph( level );
+        break;
+
+      case INVALIDATE_VIEW:
+        invalidate_drawing_area();
+        break;
+    }
   }
 
 
@@ -489,10 +1536,16 @@
       globals.hinting_mode       = 0;
       globals.force_autohint     = FALSE;
       globals.lcd_rendering      = FALSE;
+      globals.lcd_filter         = FT_LCD_FILTER_NONE;
+      globals.direct_rendering   = FALSE;
+      globals.coverage_masking   = FALSE;
       globals.linear_blending    = FALSE;
       globals.show_subpixel_mask = FALSE;
       globals.gamma              = 1.8;
-      globals.glyph_surface      = 0;
+      globals.gamma_linear_bits  = GAMMA_LINEAR_BITS;
+      globals.glyph              = 0;
+      globals.glyph_cache_budget = GLYPH_CACHE_DEFAULT_BUDGET;
+      globals.prefetch_depth     = 2;
       globals.scale              = 0;
       globals.draw_grid          = 1;
       globals.draw_outline       = 1;
@@ -502,8 +1555,10 @@
       globals.outline_color      = (ViewerColor){1, 0, 0};
       globals.on_point_color     = globals.outline_color;
       globals.ctrl_point_color   = (ViewerColor){0, 0.7, 0};
+      globals.point_radius       = 2;
 
-      calculate_gamma_tables();
+      glyph_cache_init( globals.glyph_cache_budget );
+      glyph_rasterizer_init();
     }
 
     _setup_window();
@@ -512,6 +1567,8 @@
 
     gtk_main();
 
+    glyph_rasterizer_shutdown();
+
     return 0;
   }
 
@@ -1,99 +1,247 @@
 #include "outlineprocessing.h"
 #include FT_OUTLINE_H
+#include <glib.h>
+#include <math.h> /* for fabs */
+
+
+  /* -------------------------------------------------------------------------- *\
+   *
+   *                         == Cached outline paths ==
+   *
+  \* -------------------------------------------------------------------------- */
+
+  /*
+   * Decomposing the outline means walking the contours, converting every
+   * point from 26.6 and turning conics into cubics. The result doesn't change
+   * for a glyph so it's done once into a cairo_path_t in glyph pixels (y up)
+   * and replayed under whatever transform is current.
+   */
+  typedef struct PathBuilderRec_
+  {
+    /* Array of cairo_path_data_t */
+    GArray    *data;
+
+    /* Current point */
+    double     x, y;
+  } PathBuilder;
+
+
+  static void
+  _path_append( PathBuilder             *builder,
+                cairo_path_data_type_t   type,
+                int                      num_points,
+                const double            *points )
+  {
+    cairo_path_data_t data;
+
+    data.header.type = type;
+    data.header.length = num_points + 1;
+    g_array_append_val( builder->data, data );
+
+    for( int i = 0; i < num_points; i++ )
+    {
+      data.point.x = points[i * 2];
+      data.point.y = points[i * 2 + 1];
+      g_array_append_val( builder->data, data );
+    }
+
+    builder->x = points[num_points * 2 - 2];
+    builder->y = points[num_points * 2 - 1];
+  }
 
 
   static int
-  _move_to( const FT_Vector *to, void *user )
+  _path_move_to( const FT_Vector *to, void *user )
   {
-    cairo_move_to( (cairo_t *)user, to->x / 64.0, to->y / 64.0 );
+    double points[2] = { to->x / 64.0, to->y / 64.0 };
+
+    _path_append( (PathBuilder *)user, CAIRO_PATH_MOVE_TO, 1, points );
     return 0;
   }
 
 
   static int
-  _line_to( const FT_Vector *to, void *user )
+  _path_line_to( const FT_Vector *to, void *user )
   {
-    cairo_line_to( (cairo_t *)user, to->x / 64.0, to->y / 64.0 );
+    double points[2] = { to->x / 64.0, to->y / 64.0 };
+
+    _path_append( (PathBuilder *)user, CAIRO_PATH_LINE_TO, 1, points );
     return 0;
   }
 
 
+  /*
+   * Cairo only uses cubic bezier curves (two control points).
+   * Need to convert from quatratic (one control point) to cubic using:
+   *
+   * Quatratic - from:Q0, ctl:Q1, to:Q2
+   * Cubic - from: C0, control 1: C1, control 2:C2, to:C3
+   *
+   * C0 = Q0
+   * C3 = Q2
+   * C1 = Q0 + 2/3*(Q1-Q0)
+   * C2 = Q2 + 2/3*(Q1-Q2)
+   *
+   * See http://fontforge.github.io/bezier.html
+   */
   static int
-  _conic_to( const FT_Vector *ctl,
-             const FT_Vector *to,
-             void            *user )
+  _path_conic_to( const FT_Vector *ctl,
+                  const FT_Vector *to,
+                  void            *user )
   {
-    /*
-     * Cairo only uses cubic bezier curves (two control points).
-     * Need to convert from quatratic (one control point) to cubic using:
-     *
-     * Quatratic - from:Q0, ctl:Q1, to:Q2
-     * Cubic - from: C0, control 1: C1, control 2:C2, to:C3
-     *
-     * C0 = Q0
-     * C3 = Q2
-     * C1 = Q0 + 2/3*(Q1-Q0)
-     * C2 = Q2 + 2/3*(Q1-Q2)
-     *
-     * See http://fontforge.github.io/bezier.html
-     */
-    double cur_x,  cur_y,
-           ctl_x,  ctl_y,
-            to_x,   to_y,
-            c1_x,   c1_y,
-            c2_x,   c2_y,
-            twothird;
-
-    cairo_t *cr = (cairo_t *)user;
-    twothird = 2/3.0;
-
-    cairo_get_current_point( cr, &cur_x, &cur_y );
-
-    ctl_x = ctl->x / 64.0;
-    ctl_y = ctl->y / 64.0;
-     to_x =  to->x / 64.0;
-     to_y =  to->y / 64.0;
-
-    c1_x = cur_x + twothird * ( ctl_x - cur_x );
-    c1_y = cur_y + twothird * ( ctl_y - cur_y );
-    c2_x =  to_x + twothird * ( ctl_x -  to_x );
-    c2_y =  to_y + twothird * ( ctl_y -  to_y );
-
-    cairo_curve_to( cr, c1_x, c1_y, c2_x, c2_y, to_x, to_y);
-
+    PathBuilder *builder = (PathBuilder *)user;
+    double twothird = 2/3.0;
+    double points[6];
+
+    double ctl_x = ctl->x / 64.0,
+           ctl_y = ctl->y / 64.0,
+            to_x =  to->x / 64.0,
+            to_y =  to->y / 64.0;
+
+    points[0] = builder->x + twothird * ( ctl_x - builder->x );
+    points[1] = builder->y + twothird * ( ctl_y - builder->y );
+    points[2] = to_x + twothird * ( ctl_x - to_x );
+    points[3] = to_y + twothird * ( ctl_y - to_y );
+    points[4] = to_x;
+    points[5] = to_y;
+
+    _path_append( builder, CAIRO_PATH_CURVE_TO, 3, points );
     return 0;
   }
 
 
   static int
-  _cubic_to( const FT_Vector *c1,
-             const FT_Vector *c2,
-             const FT_Vector *to,
-             void            *user )
+  _path_cubic_to( const FT_Vector *c1,
+                  const FT_Vector *c2,
+                  const FT_Vector *to,
+                  void            *user )
   {
-    cairo_curve_to( (cairo_t *)user, c1->x / 64.0, c1->y / 64.0,
-                                     c2->x / 64.0, c2->y / 64.0,
-                                     to->x / 64.0, to->y / 64.0 );
+    double points[6] = { c1->x / 64.0, c1->y / 64.0,
+                         c2->x / 64.0, c2->y / 64.0,
+                         to->x / 64.0, to->y / 64.0 };
+
+    _path_append( (PathBuilder *)user, CAIRO_PATH_CURVE_TO, 3, points );
     return 0;
   }
 
 
-  static FT_Outline_Funcs funcs =
+  static FT_Outline_Funcs path_funcs =
   {
-    &_move_to,
-    &_line_to,
-    &_conic_to,
-    &_cubic_to,
+    &_path_move_to,
+    &_path_line_to,
+    &_path_conic_to,
+    &_path_cubic_to,
     0, 0 /* Shift, Delta */
   };
 
 
-  /* Convert the outline into a series of drawing commands and pass these */
-  /* to the cairo context.                                                */
+  /*
+   * Decompose the outline into a new path, free it with
+   * destroy_outline_path() (not cairo_path_destroy()). Doesn't use any cairo
+   * or Freetype state so can be called from any thread.
+   */
+  cairo_path_t *
+  create_outline_path( const FT_Outline *outline )
+  {
+    cairo_path_t *path = g_new( cairo_path_t, 1 );
+    PathBuilder builder;
+
+    builder.data = g_array_new( FALSE, FALSE, sizeof( cairo_path_data_t ) );
+    builder.x = builder.y = 0;
+
+    FT_Outline_Decompose( (FT_Outline *)outline, &path_funcs, &builder );
+
+    path->status = CAIRO_STATUS_SUCCESS;
+    path->num_data = builder.data->len;
+    path->data = (cairo_path_data_t *) g_array_free( builder.data, FALSE );
+
+    return path;
+  }
+
+
   void
-  process_outline( cairo_t *cr, FT_Outline *outline )
+  destroy_outline_path( cairo_path_t *path )
+  {
+    if( !path )
+      return;
+
+    g_free( path->data );
+    g_free( path );
+  }
+
+
+  /*
+   * Add an outline path to the cairo context, leaving out segments further
+   * than margin (in device pixels, to allow for the stroke) from the current
+   * clip. A bezier curve stays inside the box around its points so a segment
+   * can be dropped when that box is outside the clip; the pen is still moved
+   * to its end so the following ones start in the right place.
+   *
+   * Returns non-zero if the last contour was broken up, closing the path
+   * would then draw a line that isn't part of the outline.
+   */
+  int
+  append_outline_path_clipped( cairo_t             *cr,
+                               const cairo_path_t  *path,
+                               double               margin )
   {
-    FT_Outline_Decompose( outline, &funcs, (void*)cr );
+    double x1, y1, x2, y2;
+    double margin_x = margin, margin_y = margin;
+    double x = 0, y = 0;
+    int broken = 0;
+
+    cairo_clip_extents( cr, &x1, &y1, &x2, &y2 );
+    cairo_device_to_user_distance( cr, &margin_x, &margin_y );
+
+    x1 -= fabs( margin_x );
+    x2 += fabs( margin_x );
+    y1 -= fabs( margin_y );
+    y2 += fabs( margin_y );
+
+    for( int i = 0; i < path->num_data; i += path->data[i].header.length )
+    {
+      const cairo_path_data_t *p = &path->data[i + 1];
+      int num_points = path->data[i].header.length - 1;
+      double x_min = x, x_max = x,
+             y_min = y, y_max = y;
+
+      if( num_points == 0 )
+        continue;
+
+      for( int j = 0; j < num_points; j++ )
+      {
+        x_min = MIN( x_min, p[j].point.x );
+        x_max = MAX( x_max, p[j].point.x );
+        y_min = MIN( y_min, p[j].point.y );
+        y_max = MAX( y_max, p[j].point.y );
+      }
+
+      x = p[num_points - 1].point.x;
+      y = p[num_points - 1].point.y;
+
+      if( path->data[i].header.type == CAIRO_PATH_MOVE_TO )
+      {
+        cairo_move_to( cr, x, y );
+        broken = 0;
+      }
+      else if( x_max < x1 || x_min > x2 || y_max < y1 || y_min > y2 )
+      {
+        cairo_move_to( cr, x, y );
+        broken = 1;
+      }
+      else if( path->data[i].header.type == CAIRO_PATH_LINE_TO )
+      {
+        cairo_line_to( cr, x, y );
+      }
+      else
+      {
+        cairo_curve_to( cr, p[0].point.x, p[0].point.y,
+                            p[1].point.x, p[1].point.y,
+                            x, y );
+      }
+    }
+
+    return broken;
   }
 
 
@@ -6,8 +6,16 @@
 #ifndef OUTLINE_PROCESSING_H_
 #define OUTLINE_PROCESSING_H_
 
+  cairo_path_t *
+  create_outline_path( const FT_Outline *outline );
+
   void
-  process_outline( cairo_t *cr, FT_Outline *outline );
+  destroy_outline_path( cairo_path_t *path );
+
+  int
+  append_outline_path_clipped( cairo_t             *cr,
+                               const cairo_path_t  *path,
+                               double               margin );
 
 
 #endif /* OUTLINE_PROCESSING_H_ */
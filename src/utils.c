@@ -1,8 +1,10 @@
 #include "utils.h"
 
+#include <glib.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 
   void
   panic( const char*  fmt, ... )
@@ -17,4 +19,24 @@
   }
 
 
+  /*
+   * Copy a block of memory into a new g_malloc() block, NULL if the size is
+   * 0. Used instead of g_memdup() which is deprecated and takes the size as a
+   * guint.
+   */
+  void *
+  duplicate_memory( const void *mem, size_t size )
+  {
+    void *copy;
+
+    if( !mem || size == 0 )
+      return NULL;
+
+    copy = g_malloc( size );
+    memcpy( copy, mem, size );
+
+    return copy;
+  }
+
+
 /* END */
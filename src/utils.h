@@ -1,6 +1,8 @@
 #ifndef UTILS_H_
 #define UTILS_H_
 
+#include <stddef.h>
+
 
 /*
  * Wrap an operation in a pair of save/restore calls. Would be nice if there
@@ -18,6 +20,9 @@
   void
   panic( const char*  fmt, ... );
 
+  void *
+  duplicate_memory( const void *mem, size_t size );
+
 
 #endif /* UTILS_H_ */
 
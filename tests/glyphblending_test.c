@@ -0,0 +1,773 @@
+#include "glyphblending.h"
+#include "glyphblending_kernels.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Glyph blending output test
+ *
+ * Checks that the SIMD blending kernels give exactly the same pixels as the
+ * plain C kernels on random rows, and that blend_glyph_to_surface() and
+ * blend_glyph_to_solid_surface() give the same pixels as the original per
+ * pixel blending loop, which is kept here as the reference.
+ */
+
+
+/* -------------------------------------------------------------------------- *\
+ *
+ *                             == Test input ==
+ *
+\* -------------------------------------------------------------------------- */
+
+
+  static guint32 _random_state;
+
+
+  /* xorshift32, so every run tests the same input */
+  static guint32
+  _random()
+  {
+    _random_state ^= _random_state << 13;
+    _random_state ^= _random_state >> 17;
+    _random_state ^= _random_state << 5;
+
+    return _random_state;
+  }
+
+
+  /*
+   * Fill coverage values with runs of empty, full and partial coverage like
+   * a glyph has, plus runs mixing all three so LCD pixels get some channels
+   * empty or full.
+   */
+  static void
+  _fill_coverage( unsigned char *src, unsigned int length )
+  {
+    unsigned int i = 0;
+
+    while( i < length )
+    {
+      unsigned int run = 1 + _random() % 12;
+      unsigned int kind = _random() % 4;
+
+      for( ; run > 0 && i < length; run--, i++ )
+      {
+        switch( kind )
+        {
+          case 0:
+            src[i] = 0x00;
+            break;
+
+          case 1:
+            src[i] = 0xFF;
+            break;
+
+          case 2:
+            src[i] = (unsigned char) _random();
+            break;
+
+          default:
+            src[i] = (unsigned char)( _random() % 3 == 0 ? 0x00
+                                      : _random() % 2 == 0 ? 0xFF
+                                      : _random() );
+            break;
+        }
+      }
+    }
+  }
+
+
+  /* A color component, biased towards the extremes */
+  static unsigned char
+  _random_component()
+  {
+    switch( _random() % 4 )
+    {
+      case 0:
+        return 0x00;
+
+      case 1:
+        return 0xFF;
+
+      default:
+        return (unsigned char) _random();
+    }
+  }
+
+
+/* -------------------------------------------------------------------------- *\
+ *
+ *                        == Kernel comparison ==
+ *
+ * Every kernel set the CPU supports is run on the same random rows as the
+ * plain C kernels. The rows are offset from their allocations so the SIMD
+ * loads and stores aren't always aligned.
+ *
+\* -------------------------------------------------------------------------- */
+
+
+/* Widths 0 to this are all tested as well as _extra_widths */
+#define _MAX_SMALL_WIDTH 67
+
+
+  static const unsigned int _extra_widths[] = { 127, 128, 129, 255, 1001 };
+
+  static const double _gammas[] = { 1.0, 1.2, 1.8, 2.2, 2.8 };
+
+  static const unsigned int _linear_bits[] =
+  {
+    GAMMA_LINEAR_BITS,
+    GAMMA_LINEAR_BITS_HIGH
+  };
+
+
+  static int
+  _get_kernel_sets( const BlendKernels **sets )
+  {
+    int num_sets = 0;
+
+    sets[num_sets++] = &blend_kernels_scalar;
+
+#ifdef GLYPH_BLENDING_X86_KERNELS
+    __builtin_cpu_init();
+
+    if( __builtin_cpu_supports( "sse2" ) )
+      sets[num_sets++] = &blend_kernels_sse2;
+    else
+      printf( "Skipping SSE2 kernels, not supported by this CPU\n" );
+
+    if( __builtin_cpu_supports( "avx2" ) )
+      sets[num_sets++] = &blend_kernels_avx2;
+    else
+      printf( "Skipping AVX2 kernels, not supported by this CPU\n" );
+#endif
+
+    return num_sets;
+  }
+
+
+  static BlendRowFunc
+  _get_row_func( const BlendKernels *kernels, gboolean linear, gboolean lcd )
+  {
+    if( linear )
+      return lcd ? kernels->linear_lcd : kernels->linear_gray;
+
+    return lcd ? kernels->simple_lcd : kernels->simple_gray;
+  }
+
+
+  /*
+   * Blend the same random row with the plain C kernel and the kernel from
+   * the set given. Returns FALSE and prints the first difference if the
+   * output isn't the same.
+   */
+  static gboolean
+  _compare_row( const BlendKernels  *kernels,
+                gboolean             linear,
+                gboolean             lcd,
+                unsigned int         width,
+                const BlendParams   *params,
+                const char          *what )
+  {
+    unsigned int src_pix_bytes = lcd ? 3 : 1;
+    unsigned int src_offset = _random() % 4;
+    unsigned int dest_offset = _random() % 4;
+    unsigned char *src;
+    unsigned int *expected, *actual;
+    gboolean same = TRUE;
+
+    src = g_malloc( src_offset + width * src_pix_bytes + 1 );
+    expected = g_new( unsigned int, dest_offset + width + 1 );
+    actual = g_new( unsigned int, dest_offset + width + 1 );
+
+    _fill_coverage( src + src_offset, width * src_pix_bytes );
+
+    for( unsigned int x = 0; x < width; x++ )
+      expected[dest_offset + x] = actual[dest_offset + x] = _random();
+
+    _get_row_func( &blend_kernels_scalar, linear, lcd )(
+        expected + dest_offset, src + src_offset, width, params );
+
+    _get_row_func( kernels, linear, lcd )(
+        actual + dest_offset, src + src_offset, width, params );
+
+    for( unsigned int x = 0; x < width; x++ )
+    {
+      if( expected[dest_offset + x] != actual[dest_offset + x] )
+      {
+        printf( "FAIL: %s %s %s %s width %u: pixel %u is %06X, "
+                "expected %06X\n",
+                kernels->name, linear ? "linear" : "simple",
+                lcd ? "lcd" : "gray", what, width, x,
+                actual[dest_offset + x], expected[dest_offset + x] );
+
+        same = FALSE;
+        break;
+      }
+    }
+
+    g_free( src );
+    g_free( expected );
+    g_free( actual );
+
+    return same;
+  }
+
+
+  static gboolean
+  _compare_width( const BlendKernels *kernels, unsigned int width )
+  {
+    gboolean passed = TRUE;
+
+    for( int lcd = 0; lcd < 2; lcd++ )
+    {
+      for( int i = 0; i < 3; i++ )
+      {
+        BlendParams params = { _random_component(), _random_component(),
+                               _random_component(), NULL, NULL };
+
+        passed &= _compare_row( kernels, FALSE, lcd, width, &params, "" );
+      }
+
+      for( guint g = 0; g < G_N_ELEMENTS( _gammas ); g++ )
+      {
+        for( guint b = 0; b < G_N_ELEMENTS( _linear_bits ); b++ )
+        {
+          const GammaTables *tables;
+          BlendParams params;
+          char what[32];
+
+          /* Blending never picks these kernels for the tables */
+          if( _linear_bits[b] > kernels->linear_bits_max )
+            continue;
+
+          tables = get_gamma_tables( _gammas[g], _linear_bits[b] );
+
+          params.red   = tables->to_linear[_random_component()];
+          params.green = tables->to_linear[_random_component()];
+          params.blue  = tables->to_linear[_random_component()];
+          params.gamma_table = tables->to_linear;
+          params.gamma_inv_table = tables->from_linear;
+
+          g_snprintf( what, sizeof( what ), "gamma %.1f %u bit",
+                      _gammas[g], _linear_bits[b] );
+
+          passed &= _compare_row( kernels, TRUE, lcd, width, &params, what );
+        }
+      }
+    }
+
+    return passed;
+  }
+
+
+  static gboolean
+  _compare_kernels()
+  {
+    const BlendKernels *sets[3];
+    int num_sets = _get_kernel_sets( sets );
+    gboolean passed = TRUE;
+
+    for( int s = 1; s < num_sets; s++ )
+    {
+      gboolean set_passed = TRUE;
+
+      for( unsigned int width = 0; width <= _MAX_SMALL_WIDTH; width++ )
+        set_passed &= _compare_width( sets[s], width );
+
+      for( guint i = 0; i < G_N_ELEMENTS( _extra_widths ); i++ )
+        set_passed &= _compare_width( sets[s], _extra_widths[i] );
+
+      printf( "%s kernels: %s\n", sets[s]->name,
+              set_passed ? "same as C" : "DIFFERENT" );
+
+      passed &= set_passed;
+    }
+
+    return passed;
+  }
+
+
+/* -------------------------------------------------------------------------- *\
+ *
+ *                        == Reference blending ==
+ *
+ * The per pixel blending loop from before the blending kernels were added,
+ * kept as it was apart from reading the gamma tables from _reference_linear
+ * instead of the viewer's globals. blend_glyph_to_surface() and
+ * blend_glyph_to_solid_surface() must give the same pixels as it does.
+ *
+\* -------------------------------------------------------------------------- */
+
+
+  /* Gamma tables for the reference linear blending */
+  static const GammaTables *_reference_linear;
+
+
+#define _BLENDING_LOOP( dest, src, r, g, b, func )                           \
+  do {                                                                       \
+    unsigned int width, height, pitch, stride;                               \
+    unsigned char *data;                                                     \
+    unsigned char is_rgb, src_pix_bytes, _0, _1, _2;                         \
+                                                                             \
+    is_rgb = ( src->pixel_mode == FT_PIXEL_MODE_LCD ) ? 1 : 0;               \
+                                                                             \
+    if( is_rgb )                                                             \
+    {                                                                        \
+      width = src->width / 3;                                                \
+      src_pix_bytes = 3;                                                     \
+      _0 = 0;                                                                \
+      _1 = 1;                                                                \
+      _2 = 2;                                                                \
+    }                                                                        \
+    else                                                                     \
+    {                                                                        \
+      width = src->width;                                                    \
+      src_pix_bytes = 1;                                                     \
+      _0 = _1 = _2 = 0;                                                      \
+    }                                                                        \
+                                                                             \
+    height = src->rows;                                                      \
+    pitch = (unsigned int) abs( src->pitch );                                \
+    stride = (unsigned int) cairo_image_surface_get_stride( dest );          \
+    data = cairo_image_surface_get_data( dest );                             \
+                                                                             \
+    cairo_surface_flush( dest );                                             \
+                                                                             \
+    for( unsigned int y = 0; y < height; y++ )                               \
+    {                                                                        \
+      unsigned char* srow = ( (unsigned char*) src->buffer ) + y * pitch;    \
+      unsigned int* drow = (unsigned int*) ( data + y * stride );            \
+                                                                             \
+      for( unsigned int x = 0; x < width; x++ )                              \
+      {                                                                      \
+        unsigned char* spixel = srow + x * src_pix_bytes;                    \
+        unsigned int* dpixel = drow + x;                                     \
+        func( dpixel, spixel, _0, _1, _2, r, g, b );                         \
+      }                                                                      \
+    }                                                                        \
+                                                                             \
+    cairo_surface_mark_dirty( dest );                                        \
+  } while( 0 )
+
+
+#define _ALPHA_BLEND( bg, a, fg ) \
+  ( fg * a + bg * ( 255 - a ) ) / 255
+
+#define _GET_RED( pixel ) \
+  (unsigned char)( ( pixel >> 16 ) & 0xFF )
+
+#define _GET_GREEN( pixel ) \
+  (unsigned char)( ( pixel >> 8 ) & 0xFF )
+
+#define _GET_BLUE( pixel ) \
+  (unsigned char)( pixel & 0xff )
+
+#define _PIXEL( r, g, b ) \
+  ( ((unsigned int) r) << 16 | ((unsigned int) g) << 8 | b )
+
+
+#define _BLEND_SIMPLE_FUNC( dest, src, _0, _1, _2, r, g, b )     \
+  do {                                                           \
+    unsigned char pix_r, pix_g, pix_b;                           \
+                                                                 \
+    pix_r = _GET_RED( dest[0] );                                 \
+    pix_g = _GET_GREEN( dest[0] );                               \
+    pix_b = _GET_BLUE( dest[0] );                                \
+                                                                 \
+    pix_r = _ALPHA_BLEND( pix_r, src[ _0 ], r );                 \
+    pix_g = _ALPHA_BLEND( pix_g, src[ _1 ], g );                 \
+    pix_b = _ALPHA_BLEND( pix_b, src[ _2 ], b );                 \
+                                                                 \
+    dest[0] = _PIXEL( pix_r, pix_g, pix_b );                     \
+  } while( 0 )
+
+
+#define _BLEND_LINEAR_FUNC( dest, src, _0, _1, _2, r, g, b )              \
+  do {                                                                    \
+    unsigned char pix_r, pix_g, pix_b;                                    \
+    unsigned int lin_r, lin_g, lin_b;                                     \
+                                                                          \
+    pix_r = _GET_RED( dest[0] );                                          \
+    pix_g = _GET_GREEN( dest[0] );                                        \
+    pix_b = _GET_BLUE( dest[0] );                                         \
+                                                                          \
+    lin_r = _reference_linear->to_linear[pix_r];                          \
+    lin_g = _reference_linear->to_linear[pix_g];                          \
+    lin_b = _reference_linear->to_linear[pix_b];                          \
+                                                                          \
+    lin_r = _ALPHA_BLEND( lin_r, src[ _0 ], r );                          \
+    lin_g = _ALPHA_BLEND( lin_g, src[ _1 ], g );                          \
+    lin_b = _ALPHA_BLEND( lin_b, src[ _2 ], b );                          \
+                                                                          \
+    pix_r = _reference_linear->from_linear[(unsigned short) lin_r];       \
+    pix_g = _reference_linear->from_linear[(unsigned short) lin_g];       \
+    pix_b = _reference_linear->from_linear[(unsigned short) lin_b];       \
+                                                                          \
+    dest[0] = _PIXEL( pix_r, pix_g, pix_b );                              \
+  } while( 0 )
+
+
+  /* The original blend_glyph_to_surface(). */
+  static void
+  _reference_blend( FT_Bitmap          *bitmap,
+                    cairo_surface_t    *surface,
+                    const double        color[3],
+                    const GammaTables  *linear )
+  {
+    unsigned char r, g, b;
+
+    r = (unsigned char)( color[0] * 255 );
+    g = (unsigned char)( color[1] * 255 );
+    b = (unsigned char)( color[2] * 255 );
+
+    if( linear )
+    {
+      unsigned short c_r, c_g, c_b;
+
+      _reference_linear = linear;
+
+      c_r = linear->to_linear[r];
+      c_g = linear->to_linear[g];
+      c_b = linear->to_linear[b];
+
+      _BLENDING_LOOP( surface, bitmap, c_r, c_g, c_b, _BLEND_LINEAR_FUNC );
+    }
+    else
+      _BLENDING_LOOP( surface, bitmap, r, g, b, _BLEND_SIMPLE_FUNC );
+  }
+
+
+/* -------------------------------------------------------------------------- *\
+ *
+ *                         == Reference output ==
+ *
+ * Each case blends a random coverage bitmap onto a surface of random pixels
+ * with blend_glyph_to_surface() and onto a solid background with
+ * blend_glyph_to_solid_surface(), going through the normal kernel selection,
+ * and compares every pixel with the reference loop's.
+ *
+ * The one allowed difference: pixels with no coverage at all aren't blended
+ * any more, they're left as the destination (or background). With simple
+ * blending that's what the reference gives anyway, but a linear round trip
+ * can change them. Those pixels must be exactly the unblended value.
+ *
+\* -------------------------------------------------------------------------- */
+
+
+  typedef struct ReferenceSizeRec_
+  {
+    unsigned int     width;
+    unsigned int     rows;
+  } ReferenceSize;
+
+
+  typedef struct ReferenceBlendRec_
+  {
+    /* 0 for simple blending */
+    double           gamma;
+    unsigned int     linear_bits;
+  } ReferenceBlend;
+
+
+  static const ReferenceSize _reference_sizes[] =
+  {
+    { 1, 1 }, { 7, 5 }, { 16, 4 }, { 33, 17 }, { 130, 9 }
+  };
+
+  static const ReferenceBlend _reference_blends[] =
+  {
+    { 0.0, 0 },
+    { 1.8, GAMMA_LINEAR_BITS },
+    { 2.2, GAMMA_LINEAR_BITS },
+    { 2.2, GAMMA_LINEAR_BITS_HIGH }
+  };
+
+  /* Foreground and background colors, used in turn by each case. The */
+  /* components are multiples of 0.2 so cairo fills the background    */
+  /* with exactly the 8 bit value they scale to.                      */
+  static const double _reference_colors[][2][3] =
+  {
+    { { 0.0, 0.0, 0.0 }, { 1.0, 1.0, 1.0 } },
+    { { 1.0, 1.0, 1.0 }, { 0.0, 0.0, 0.0 } },
+    { { 0.2, 0.4, 0.6 }, { 1.0, 0.8, 0.0 } }
+  };
+
+
+  /*
+   * Make the coverage bitmap for a case. The pitch is padded with random
+   * bytes that must not affect the output.
+   */
+  static void
+  _make_bitmap( FT_Bitmap *bitmap, const ReferenceSize *size, gboolean lcd )
+  {
+    unsigned int bytes = size->width * ( lcd ? 3 : 1 );
+    unsigned int pitch = ( ( bytes + 3 ) & ~3u ) + 4;
+
+    memset( bitmap, 0, sizeof( *bitmap ) );
+
+    bitmap->rows = size->rows;
+    bitmap->width = bytes;
+    bitmap->pitch = (int) pitch;
+    bitmap->pixel_mode = lcd ? FT_PIXEL_MODE_LCD : FT_PIXEL_MODE_GRAY;
+    bitmap->buffer = g_malloc( pitch * size->rows );
+
+    for( unsigned int y = 0; y < size->rows; y++ )
+    {
+      unsigned char *row = bitmap->buffer + y * pitch;
+
+      _fill_coverage( row, bytes );
+
+      for( unsigned int x = bytes; x < pitch; x++ )
+        row[x] = (unsigned char) _random();
+    }
+  }
+
+
+  static unsigned int *
+  _get_pixel( cairo_surface_t *surface, int x, int y )
+  {
+    return (unsigned int *)( cairo_image_surface_get_data( surface ) +
+                             y * cairo_image_surface_get_stride( surface ) ) +
+           x;
+  }
+
+
+  static void
+  _fill_random_pixels( cairo_surface_t *surface )
+  {
+    int width = cairo_image_surface_get_width( surface );
+    int height = cairo_image_surface_get_height( surface );
+
+    cairo_surface_flush( surface );
+
+    for( int y = 0; y < height; y++ )
+    {
+      for( int x = 0; x < width; x++ )
+        *_get_pixel( surface, x, y ) = _random() & 0xFFFFFF;
+    }
+
+    cairo_surface_mark_dirty( surface );
+  }
+
+
+  /* A surface for the bitmap with the same pixels as another. */
+  static cairo_surface_t *
+  _copy_surface( FT_Bitmap *bitmap, cairo_surface_t *src )
+  {
+    cairo_surface_t *surface = create_surface_for_ft_bitmap_dimensions(
+                                   bitmap );
+    cairo_t *cr = cairo_create( surface );
+
+    cairo_set_operator( cr, CAIRO_OPERATOR_SOURCE );
+    cairo_set_source_surface( cr, src, 0, 0 );
+    cairo_paint( cr );
+    cairo_destroy( cr );
+
+    return surface;
+  }
+
+
+  /* A surface for the bitmap filled with a color the way the viewer does. */
+  static cairo_surface_t *
+  _create_filled_surface( FT_Bitmap *bitmap, const double color[3] )
+  {
+    cairo_surface_t *surface = create_surface_for_ft_bitmap_dimensions(
+                                   bitmap );
+    cairo_t *cr = cairo_create( surface );
+
+    cairo_set_source_rgb( cr, color[0], color[1], color[2] );
+    cairo_paint( cr );
+    cairo_destroy( cr );
+
+    return surface;
+  }
+
+
+  static gboolean
+  _is_empty_coverage( const FT_Bitmap *bitmap, int x, int y )
+  {
+    const unsigned char *row = bitmap->buffer + y * bitmap->pitch;
+
+    if( bitmap->pixel_mode == FT_PIXEL_MODE_LCD )
+      return ( row[x * 3] | row[x * 3 + 1] | row[x * 3 + 2] ) == 0;
+
+    return row[x] == 0;
+  }
+
+
+  /*
+   * Compare a blended surface with the reference. unblended has the pixels
+   * from before blending, zero coverage pixels may be those instead for
+   * linear blending and are counted in empty_kept. Returns FALSE and prints
+   * the first difference that isn't allowed.
+   */
+  static gboolean
+  _compare_with_reference( const FT_Bitmap  *bitmap,
+                           cairo_surface_t  *actual,
+                           cairo_surface_t  *expected,
+                           cairo_surface_t  *unblended,
+                           gboolean          linear,
+                           const char       *what,
+                           unsigned int     *empty_kept )
+  {
+    int width = cairo_image_surface_get_width( actual );
+    int height = cairo_image_surface_get_height( actual );
+
+    cairo_surface_flush( actual );
+    cairo_surface_flush( expected );
+    cairo_surface_flush( unblended );
+
+    for( int y = 0; y < height; y++ )
+    {
+      for( int x = 0; x < width; x++ )
+      {
+        unsigned int a = *_get_pixel( actual, x, y ) & 0xFFFFFF;
+        unsigned int e = *_get_pixel( expected, x, y ) & 0xFFFFFF;
+        unsigned int u = *_get_pixel( unblended, x, y ) & 0xFFFFFF;
+
+        if( a == e )
+          continue;
+
+        if( linear && _is_empty_coverage( bitmap, x, y ) && a == u )
+        {
+          ( *empty_kept )++;
+          continue;
+        }
+
+        printf( "FAIL: %s: pixel %d,%d is %06X, expected %06X", what, x, y,
+                a, e );
+
+        if( _is_empty_coverage( bitmap, x, y ) )
+          printf( " (no coverage, unblended %06X)", u );
+
+        printf( "\n" );
+        return FALSE;
+      }
+    }
+
+    return TRUE;
+  }
+
+
+  static gboolean
+  _run_reference_case( unsigned int           index,
+                       const ReferenceSize   *size,
+                       gboolean               lcd,
+                       const ReferenceBlend  *blend,
+                       unsigned int          *empty_kept )
+  {
+    const double (*colors)[3] =
+        _reference_colors[index % G_N_ELEMENTS( _reference_colors )];
+    const GammaTables *linear = NULL;
+    cairo_surface_t *actual, *expected, *unblended;
+    FT_Bitmap bitmap;
+    gboolean passed = TRUE;
+    char what[96];
+
+    if( blend->linear_bits )
+      linear = get_gamma_tables( blend->gamma, blend->linear_bits );
+
+    _make_bitmap( &bitmap, size, lcd );
+
+    g_snprintf( what, sizeof( what ), "case %u (%ux%u %s %s, gamma %.1f %u bit)",
+                index, size->width, size->rows, lcd ? "lcd" : "gray",
+                linear ? "linear" : "simple", blend->gamma,
+                blend->linear_bits );
+
+    /* Onto random pixels */
+    unblended = create_surface_for_ft_bitmap_dimensions( &bitmap );
+    _fill_random_pixels( unblended );
+
+    actual = _copy_surface( &bitmap, unblended );
+    expected = _copy_surface( &bitmap, unblended );
+
+    blend_glyph_to_surface( &bitmap, actual,
+                            colors[0][0], colors[0][1], colors[0][2], linear );
+    _reference_blend( &bitmap, expected, colors[0], linear );
+
+    if( !_compare_with_reference( &bitmap, actual, expected, unblended,
+                                  linear != NULL, what, empty_kept ) )
+    {
+      printf( "      blend_glyph_to_surface differs from the reference\n" );
+      passed = FALSE;
+    }
+
+    cairo_surface_destroy( actual );
+    cairo_surface_destroy( expected );
+    cairo_surface_destroy( unblended );
+
+    /* Onto a solid background, the surface's old pixels mustn't matter */
+    unblended = _create_filled_surface( &bitmap, colors[1] );
+    expected = _create_filled_surface( &bitmap, colors[1] );
+    _reference_blend( &bitmap, expected, colors[0], linear );
+
+    actual = create_surface_for_ft_bitmap_dimensions( &bitmap );
+    _fill_random_pixels( actual );
+    blend_glyph_to_solid_surface( &bitmap, actual, colors[0], colors[1],
+                                  linear );
+
+    if( !_compare_with_reference( &bitmap, actual, expected, unblended,
+                                  linear != NULL, what, empty_kept ) )
+    {
+      printf( "      blend_glyph_to_solid_surface differs from the "
+              "reference\n" );
+      passed = FALSE;
+    }
+
+    cairo_surface_destroy( actual );
+    cairo_surface_destroy( expected );
+    cairo_surface_destroy( unblended );
+
+    g_free( bitmap.buffer );
+
+    return passed;
+  }
+
+
+  static gboolean
+  _check_reference()
+  {
+    unsigned int index = 0;
+    unsigned int empty_kept = 0;
+    gboolean passed = TRUE;
+
+    for( guint s = 0; s < G_N_ELEMENTS( _reference_sizes ); s++ )
+    {
+      for( int lcd = 0; lcd < 2; lcd++ )
+      {
+        for( guint b = 0; b < G_N_ELEMENTS( _reference_blends ); b++ )
+          passed &= _run_reference_case( index++,
+                                         &_reference_sizes[s], lcd,
+                                         &_reference_blends[b],
+                                         &empty_kept );
+      }
+    }
+
+    printf( "Reference output (%s kernels): %s, %u unblended zero coverage "
+            "pixels\n", get_blend_kernels_name(),
+            passed ? "matches" : "DIFFERENT", empty_kept );
+
+    return passed;
+  }
+
+
+  int
+  main( int argc, char **argv )
+  {
+    gboolean passed = TRUE;
+
+    _random_state = 0x9E3779B9;
+    passed &= _check_reference();
+
+    _random_state = 0x2545F491;
+    passed &= _compare_kernels();
+
+    return passed ? 0 : 1;
+  }
+
+
+/* END */
\ No newline at end of file